@@ -5,6 +5,10 @@
         Maintains a kernel fifo
 
     USAGE:
+        insmod fifomod.ko [buffer_size=<bytes>]
+        It behaves as a pipe: a read returns what there is, up to its length,
+        and a write blocks until all of it is in the fifo. Writes up to
+        PIPE_BUF bytes are atomic, longer ones go in chunks as space frees.
 
     CONDITIONAL COMPILATION
 
@@ -18,7 +22,10 @@
 #include <linux/kernel.h>
 #include <linux/proc_fs.h>
 #include <linux/vmalloc.h>
-#include <linux/semaphore.h>
+#include <linux/mutex.h>
+#include <linux/wait.h>
+#include <linux/limits.h>
+#include <linux/log2.h>
 
 #include <asm-generic/uaccess.h>
 #include <asm-generic/errno.h>
@@ -33,43 +40,73 @@ MODULE_LICENSE("GPL");
 MODULE_DESCRIPTION("Modlist kernel module - FDI-UCM");
 MODULE_AUTHOR("Daniel Pinto, Javier Bermudez");
 
-/* Because of kfifo restrictions, BUFF_ITEMS must be a power of 2 */
-#define MAX_BUFF_ITEMS (64)
-#define MAX_KBUFF MAX_BUFF_ITEMS
+#define MAX_BUFFER_SIZE (64 << 20)
 #define MODULE_NAME "fifoproc"
 
 #define kfifo_gaps(fifo) (kfifo_size(fifo)-kfifo_len(fifo))
 
+/* Because of kfifo restrictions, it is rounded up to a power of 2 */
+static unsigned int buffer_size = 64 << 10;
+module_param(buffer_size, uint, 0444);
+MODULE_PARM_DESC(buffer_size, "Capacity of the fifo in bytes, up to 64 MB");
+
+/* Writes up to this length are atomic. Longer ones are done in pieces of it */
+#define WRITE_CHUNK min_t(size_t, PIPE_BUF, kfifo_size(&buffer))
+
 static struct proc_dir_entry *proc_entry;
 
-DECLARE_KFIFO(buffer, char, MAX_BUFF_ITEMS);
+/* vmalloc'ed, a large kfifo_alloc would not find so many contiguous pages */
+struct kfifo buffer;
+void *buffer_data;
 int prod_count = 0;
 int cons_count = 0;
 
-struct semaphore mtx;
-struct semaphore sem_prod;
-struct semaphore sem_cons;
+struct mutex mtx;
+wait_queue_head_t prod_queue;   /* prods waiting for a cons, or for gaps */
+wait_queue_head_t cons_queue;   /* cons waiting for a prod, or for items */
 
 int nr_prod_waiting = 0;
 int nr_cons_waiting = 0;
 
+/* Shortest write (read) of the waiting prods (cons), UINT_MAX if none waits */
+unsigned int prod_need = UINT_MAX;
+unsigned int cons_need = UINT_MAX;
+
 /*
- * waits in the "sem" queue until someone wakes it
- * It behaves the same as var_cond_wait, but interruptible
- * If interrupted, it does not have the mutex. Do not try to release it
- * returns 0, or -1 if interrupted
+ * waits in "queue" until "cond" holds. It behaves the same as a var_cond_wait
+ * loop on mtx, but interruptible. "len" is what the caller needs from the
+ * fifo, the wakers use it to wake the queue only if it can progress.
+ * cond is checked without the mutex to sleep, and again with it.
+ * mtx is held when it returns, 0 or -EINTR if interrupted
  */
-int sem_wait_interruptible(struct semaphore *sem, struct semaphore *mutex, int *waiting);
+#define fifo_wait(queue, waiting, need, len, cond) ({       \
+    int __ret = 0;                                          \
+    while (!(cond)) {                                       \
+        (waiting)++;                                        \
+        if ((len) < (need))                                 \
+            (need) = (len);                                 \
+        mutex_unlock(&mtx);                                 \
+        __ret = wait_event_interruptible(queue, cond);      \
+        mutex_lock(&mtx);                                   \
+        if (--(waiting) == 0)                               \
+            (need) = UINT_MAX;                              \
+        if (__ret) {                                        \
+            __ret = -EINTR;                                 \
+            break;                                          \
+        }                                                   \
+    }                                                       \
+    __ret;                                                  \
+})
 
 /*
- * wakes a process waiting in "sem" queue
+ * wakes the prods if the shortest of their writes fits now (mtx held)
  */
-void sem_signal(struct semaphore *sem, int *waiting);
+void wake_prods(void);
 
 /*
- * wakes all proccesses waiting in "sem" queue
+ * wakes the cons if the shortest of their reads can be done now (mtx held)
  */
-void sem_broadcast(struct semaphore *sem, int *waiting);
+void wake_cons(void);
 
 /*****************************************************************************
  *
@@ -78,7 +115,7 @@ void sem_broadcast(struct semaphore *sem, int *waiting);
  ****************************************************************************/
 static int fifoproc_open(struct inode *inode, struct file *file) {
 
-    if (down_interruptible(&mtx)) {
+    if (mutex_lock_interruptible(&mtx)) {
         trace_printk(MODULE_NAME": Interrupted in open mutex\n");
         return -EINTR;
     }
@@ -88,15 +125,15 @@ static int fifoproc_open(struct inode *inode, struct file *file) {
     
         /* If it is the only cons, all the possible prods must be waiting for it */
         if( cons_count == 1 ) {
-            sem_broadcast(&sem_prod, &nr_prod_waiting);
+            wake_up_interruptible_all(&prod_queue);
         }
 
         /* If there are no prods, wait for someone to come */
-        while( prod_count <= 0 ) {
-            if (sem_wait_interruptible(&sem_cons, &mtx, &nr_cons_waiting)) {
-                trace_printk(MODULE_NAME": Interrupted in open condvar\n");
-                return -EINTR;
-            }
+        if (fifo_wait(cons_queue, nr_cons_waiting, cons_need, 0, prod_count > 0)) {
+            cons_count--;
+            mutex_unlock(&mtx);
+            trace_printk(MODULE_NAME": Interrupted in open condvar\n");
+            return -EINTR;
         }
         trace_printk(MODULE_NAME": CONS registered\n");
 	} else{
@@ -104,19 +141,19 @@ static int fifoproc_open(struct inode *inode, struct file *file) {
 
         /* If it is the only prod, all the possible cons must be waiting for it */
         if( prod_count == 1 ) {
-            sem_broadcast(&sem_cons, &nr_cons_waiting);
+            wake_up_interruptible_all(&cons_queue);
         }
 
          /* If there are no cons, wait for someone to come */
-        while( cons_count <= 0 ) {
-            if (sem_wait_interruptible(&sem_prod, &mtx, &nr_prod_waiting)) {
-                trace_printk(MODULE_NAME": Interrupted in open condvar\n");
-                return -EINTR;
-            }
+        if (fifo_wait(prod_queue, nr_prod_waiting, prod_need, 0, cons_count > 0)) {
+            prod_count--;
+            mutex_unlock(&mtx);
+            trace_printk(MODULE_NAME": Interrupted in open condvar\n");
+            return -EINTR;
         }
         trace_printk(MODULE_NAME": PROD registered\n");
 	}
-    up(&mtx);
+    mutex_unlock(&mtx);
 
     return 0;
 }
@@ -124,10 +161,8 @@ static int fifoproc_open(struct inode *inode, struct file *file) {
 
 static int fifoproc_release(struct inode *inode, struct file *file) {
 
-    if (down_interruptible(&mtx)) {
-        trace_printk(MODULE_NAME": Interrupted in release mutex\n");
-        return -EINTR;
-    }
+    /* release can not fail, the file is closed anyway */
+    mutex_lock(&mtx);
 
 	if ( file->f_mode & FMODE_READ ){
         trace_printk(MODULE_NAME": CONS unregistered\n");
@@ -143,107 +178,117 @@ static int fifoproc_release(struct inode *inode, struct file *file) {
     }    
     /* As there are no cons, wake all the waiting prods to allow them realize this situation */
     else if( cons_count == 0 ) {
-        sem_broadcast(&sem_prod, &nr_prod_waiting);
+        wake_up_interruptible_all(&prod_queue);
     }
     /* As there are no prods, wake all the waiting cons to allow them realize this situation */
     else if( prod_count == 0 ) {
-        sem_broadcast(&sem_cons, &nr_cons_waiting);
+        wake_up_interruptible_all(&cons_queue);
     }
 
-    up(&mtx);
+    mutex_unlock(&mtx);
 
     return 0;
 }
 
 
 static ssize_t fifoproc_read(struct file *filp, char __user *buf, size_t len, loff_t *off) {
-    int actual_len;
+    unsigned int actual_len;
     int ret_value;
 
-    if ((len > MAX_BUFF_ITEMS) || (len > MAX_KBUFF)) {
-        trace_printk(MODULE_NAME": Too much items to read\n");
-        return -ENOSPC;
+    if (len == 0) {
+        return 0;
     }
 
-    if (down_interruptible(&mtx)) {
+    if (mutex_lock_interruptible(&mtx)) {
         trace_printk(MODULE_NAME": Interrupted in read mutex\n");
         return -EINTR;
     }
 
-
-    while( kfifo_len(&buffer) < len && prod_count > 0 ) {
-        if (sem_wait_interruptible(&sem_cons, &mtx, &nr_cons_waiting)) {
-            trace_printk(MODULE_NAME": Interrupted in open condvar\n");
-            return -EINTR;
-        }
+    /* as in a pipe, wait just for something to read */
+    if (fifo_wait(cons_queue, nr_cons_waiting, cons_need, 1,
+                  !kfifo_is_empty(&buffer) || prod_count == 0)) {
+        mutex_unlock(&mtx);
+        trace_printk(MODULE_NAME": Interrupted in read condvar\n");
+        return -EINTR;
     }
 
     /* no prods and the buffer is empty */
     if( prod_count == 0 && kfifo_is_empty(&buffer) ) {
-        up(&mtx);
+        mutex_unlock(&mtx);
         trace_printk(MODULE_NAME": no prods and buff is empty\n");
         return 0;
     }
 
-    ret_value = kfifo_to_user(&buffer, buf, len, &actual_len);
+    /* take what there is, up to len */
+    ret_value = kfifo_to_user(&buffer, buf, min_t(size_t, len, kfifo_size(&buffer)), &actual_len);
     if (ret_value) {
-        up(&mtx);
+        mutex_unlock(&mtx);
         trace_printk(MODULE_NAME": Could not copy to user\n");
         return ret_value;
     }
     (*off) += actual_len;
 
-    /* Wake all prods */
-    /* it is not just a "signal" because we do not know the prod write len,
-       so it could leave gaps unwritten, and prods waiting to write*/
-    sem_broadcast(&sem_prod, &nr_prod_waiting);
+    /* Wake the prods only if the shortest of their writes fits now */
+    wake_prods();
 
-    up(&mtx);
+    mutex_unlock(&mtx);
     
     return actual_len;
 }
 
 
 static ssize_t fifoproc_write(struct file *filp, const char __user *buf, size_t len, loff_t *off) {
-    int actual_len;
-    int ret_value;
+    unsigned int actual_len;
+    size_t done = 0, need;
+    int ret_value = 0;
 
-    if (len > MAX_BUFF_ITEMS) {
-        trace_printk(MODULE_NAME": Too much items to write\n");
-        return -ENOSPC;
+    if (len == 0) {
+        return 0;
     }
 
-    if (down_interruptible(&mtx)) {
+    if (mutex_lock_interruptible(&mtx)) {
         trace_printk(MODULE_NAME": Interrupted in write mutex\n");
         return -EINTR;
     }
 
-    while( (kfifo_gaps(&buffer) < len) && (cons_count>0) ) {
-        if (sem_wait_interruptible(&sem_prod, &mtx, &nr_prod_waiting)) {
-            trace_printk(MODULE_NAME": Interrupted in open condvar\n");
-            return -EINTR;
+    while (done < len) {
+        /* the whole write if it is short, so that it is atomic */
+        need = min_t(size_t, len - done, WRITE_CHUNK);
+        if (fifo_wait(prod_queue, nr_prod_waiting, prod_need, need,
+                      kfifo_gaps(&buffer) >= need || cons_count == 0)) {
+            trace_printk(MODULE_NAME": Interrupted in write condvar\n");
+            ret_value = -EINTR;
+            break;
         }
-    }
 
-    if ( cons_count == 0 ) {
-        up(&mtx);
-        trace_printk(MODULE_NAME": No cons registered\n");
-        return -EPIPE;
+        if ( cons_count == 0 ) {
+            trace_printk(MODULE_NAME": No cons registered\n");
+            ret_value = -EPIPE;
+            break;
+        }
+
+        /* fill all the gaps there are */
+        ret_value = kfifo_from_user(&buffer, buf + done, min_t(size_t, len - done, kfifo_size(&buffer)), &actual_len);
+        done += actual_len;
+
+        /* Wake the cons only if the shortest of their reads can be done now */
+        wake_cons();
+
+        if (ret_value) {
+            trace_printk(MODULE_NAME": Could not copy from user\n");
+            break;
+        }
     }
+    
+    mutex_unlock(&mtx);
 
-    ret_value = kfifo_from_user(&buffer, buf, len, &actual_len);
-    if (ret_value) {
-        up(&mtx);
-        trace_printk(MODULE_NAME": Could not copy to user\n");
+    /* as in a pipe, what is written counts even if the rest failed */
+    if (done == 0) {
         return ret_value;
     }
-    (*off) += actual_len;
-	
-    sem_broadcast(&sem_cons, &nr_cons_waiting);
-    
-    up(&mtx);
+    (*off) += done;
 
-    return actual_len;
+    return done;
 }
 
 
@@ -268,20 +313,31 @@ static const struct file_operations proc_entry_fops = {
  ****************************************************************************/
 int init_fifoproc_module( void ) {
 
+    if (buffer_size < 2 || buffer_size > MAX_BUFFER_SIZE) {
+        printk(KERN_INFO MODULE_NAME": buffer_size must be 2 to %d bytes\n", MAX_BUFFER_SIZE);
+        return -EINVAL;
+    }
+
     /* init resources */
-    INIT_KFIFO(buffer);
+    buffer_data = vmalloc(roundup_pow_of_two(buffer_size));
+    if (buffer_data == NULL) {
+        printk(KERN_INFO MODULE_NAME": Can't create the fifo buffer\n");
+        return -ENOMEM;
+    }
+    kfifo_init(&buffer, buffer_data, roundup_pow_of_two(buffer_size));
 
-    /* condvar-like semaphores to sync prods and cons */
-    sema_init(&sem_cons, 0);
-    sema_init(&sem_prod, 0);
+    /* wait queues to sync prods and cons */
+    init_waitqueue_head(&cons_queue);
+    init_waitqueue_head(&prod_queue);
    
-    /* mutex-like semaphore for mutual exclusion */ 
-    sema_init(&mtx, 1);
+    /* mutex for mutual exclusion */ 
+    mutex_init(&mtx);
 
 
     /* create module entry */
     proc_entry = proc_create("fifoproc", 0666, NULL, &proc_entry_fops);
     if (proc_entry == NULL) {
+        vfree(buffer_data);
         printk(KERN_INFO MODULE_NAME": Can't create /proc entry\n");
         return -ENOMEM;
     }
@@ -298,7 +354,8 @@ void cleanup_fifoproc_module( void ) {
     /* remove module entry */
     remove_proc_entry(MODULE_NAME, NULL);
 
-    /* as the fifo is not dinamically allocated, there is no resources to free */
+    /* free resources */
+    vfree(buffer_data);
 
     trace_printk(MODULE_NAME": MODULE UNLOADED =========\n");
     printk(KERN_INFO MODULE_NAME": Module unloaded.\n");
@@ -311,45 +368,18 @@ module_exit( cleanup_fifoproc_module );
 
 /*****************************************************************************
  *
- * Semaphore-based syncronization functions
+ * Wait queue based syncronization functions
  *
  ****************************************************************************/
-int sem_wait_interruptible(struct semaphore *sem, struct semaphore *mutex, int *waiting) {
-
-    (*waiting)++;
-    
-    /* release the mutex */
-    up(mutex);
-
-    /* wait to be waken */
-    if (down_interruptible(sem)) {
-        down(mutex);
-        (*waiting)--;
-        up(mutex);
-        return -1;
-    }
-
-    /* get the mutex */
-    if (down_interruptible(mutex)) {
-        return -1;
+void wake_prods(void) {
+    if (nr_prod_waiting > 0 && kfifo_gaps(&buffer) >= prod_need) {
+        wake_up_interruptible(&prod_queue);
     }
-
-    return 0;
 }
 
 
-void sem_signal(struct semaphore *sem, int *waiting) {
-    if (*waiting > 0) {
-        up(sem);
-        (*waiting)--;
+void wake_cons(void) {
+    if (nr_cons_waiting > 0 && kfifo_len(&buffer) >= cons_need) {
+        wake_up_interruptible(&cons_queue);
     }
 }
-
-
-void sem_broadcast(struct semaphore *sem, int *waiting) {
-    while (*waiting > 0) {
-        up(sem);
-        (*waiting)--;
-    }
-}
-
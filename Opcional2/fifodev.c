@@ -5,10 +5,31 @@
         Maintains a kernel fifo
 
     USAGE:
+        insmod fifomod.ko [buffer_size=<bytes>]
+        It behaves as a pipe: a read returns what there is, up to its length,
+        and a write blocks until all of it is in the fifo. Writes up to
+        PIPE_BUF bytes are atomic, longer ones go in chunks as space frees.
+        A file open for read and write is a prod and a cons, and does not wait
+        in open, as in a pipe.
+        mmap of /dev/fifodev                maps the ring, its indices included,
+                                            so that data moves without system
+                                            calls (fifodev_ioctl.h)
+        ioctl(fd, FIFODEV_IOC_WAIT_DATA, n) waits for n bytes in the ring
+        ioctl(fd, FIFODEV_IOC_WAIT_ROOM, n) waits for room for n bytes
+        ioctl(fd, FIFODEV_IOC_WAKE)         wakes who waits for what the caller
+                                            made by moving an index
 
     CONDITIONAL COMPILATION
 
     COMMENTARIES
+        The ring and its indices are in a vmalloc_user'ed area, that read and
+        write use and mmap maps. As user space can write the indices, the
+        kernel masks every index and never takes more than size bytes as the
+        length of the ring: a bad index spoils the data, not the kernel.
+        Every waiter, in read, write or the wait ioctls, leaves the length it
+        needs in the ring (prod_need, cons_need) before it sleeps, so a side
+        that moves an index in the mapping knows when to call the kernel to
+        wake it up.
 
 =======================================================================================
 */
@@ -18,61 +39,121 @@
 #include <linux/kernel.h>
 #include <linux/device.h>
 #include <linux/vmalloc.h>
-#include <linux/semaphore.h>
+#include <linux/mutex.h>
+#include <linux/wait.h>
+#include <linux/limits.h>
+#include <linux/log2.h>
+#include <linux/mm.h>
 
 #include <asm-generic/uaccess.h>
 #include <asm-generic/errno.h>
 
 #include <linux/ftrace.h>
 
-#include <linux/kfifo.h>
 #include <linux/string.h>
+#include "fifodev_ioctl.h"
 
 
 MODULE_LICENSE("GPL");
 MODULE_DESCRIPTION("Modlist kernel module - FDI-UCM");
 MODULE_AUTHOR("Daniel Pinto, Javier Bermudez");
 
-/* Because of kfifo restrictions, BUFF_ITEMS must be a power of 2 */
-#define MAX_BUFF_ITEMS (64)
-#define MAX_KBUFF MAX_BUFF_ITEMS
+#define MAX_BUFFER_SIZE (64 << 20)
 #define MODULE_NAME "fifodev"
 #define CLASS_NAME  "fifodev"
 
-#define kfifo_gaps(fifo) (kfifo_size(fifo)-kfifo_len(fifo))
+/* So that the indices can run free, it is rounded up to a power of 2 */
+static unsigned int buffer_size = 64 << 10;
+module_param(buffer_size, uint, 0444);
+MODULE_PARM_DESC(buffer_size, "Capacity of the fifo in bytes, up to 64 MB");
+
+/* Writes up to this length are atomic. Longer ones are done in pieces of it */
+#define WRITE_CHUNK min_t(size_t, PIPE_BUF, ring_mask + 1)
 
 static int major_number;
 static struct class *char_class = NULL;
 static struct device *char_device = NULL;
 
-DECLARE_KFIFO(buffer, char, MAX_BUFF_ITEMS);
+/*
+ * vmalloc_user'ed, ring_bytes long: the page of the ring, then its data. The
+ * kernel keeps its own mask, user space may write anything in the ring
+ */
+struct fifodev_ring *ring;
+char *ring_data;
+unsigned int ring_mask;
+unsigned long ring_bytes;
 int prod_count = 0;
 int cons_count = 0;
 
-struct semaphore mtx;
-struct semaphore sem_prod;
-struct semaphore sem_cons;
+struct mutex mtx;
+wait_queue_head_t prod_queue;   /* prods waiting for a cons, or for gaps */
+wait_queue_head_t cons_queue;   /* cons waiting for a prod, or for items */
 
 int nr_prod_waiting = 0;
 int nr_cons_waiting = 0;
 
+/* Shortest write (read) of the waiting prods (cons), UINT_MAX if none waits */
+unsigned int prod_need = UINT_MAX;
+unsigned int cons_need = UINT_MAX;
+
+/* Copies prod_need and cons_need to the ring, for the wakers in user space */
+static inline void publish_needs(void) {
+    WRITE_ONCE(ring->prod_need, prod_need);
+    WRITE_ONCE(ring->cons_need, cons_need);
+}
+
+/*
+ * waits in "queue" until "cond" holds. It behaves the same as a var_cond_wait
+ * loop on mtx, but interruptible. "len" is what the caller needs from the
+ * fifo, the wakers use it to wake the queue only if it can progress.
+ * cond is checked without the mutex to sleep, and again with it.
+ * mtx is held when it returns, 0 or -EINTR if interrupted
+ */
+#define fifo_wait(queue, waiting, need, len, cond) ({       \
+    int __ret = 0;                                          \
+    while (!(cond)) {                                       \
+        (waiting)++;                                        \
+        if ((len) < (need))                                 \
+            (need) = (len);                                 \
+        publish_needs();                                    \
+        mutex_unlock(&mtx);                                 \
+        __ret = wait_event_interruptible(queue, cond);      \
+        mutex_lock(&mtx);                                   \
+        if (--(waiting) == 0)                               \
+            (need) = UINT_MAX;                              \
+        publish_needs();                                    \
+        if (__ret) {                                        \
+            __ret = -EINTR;                                 \
+            break;                                          \
+        }                                                   \
+    }                                                       \
+    __ret;                                                  \
+})
+
 /*
- * waits in the "sem" queue until someone wakes it
- * It behaves the same as var_cond_wait, but interruptible
- * If interrupted, it does not have the mutex. Do not try to release it
- * returns 0, or -1 if interrupted
+ * wakes the prods if the shortest of their writes fits now (mtx held)
  */
-int sem_wait_interruptible(struct semaphore *sem, struct semaphore *mutex, int *waiting);
+void wake_prods(void);
 
 /*
- * wakes a process waiting in "sem" queue
+ * wakes the cons if the shortest of their reads can be done now (mtx held)
  */
-void sem_signal(struct semaphore *sem, int *waiting);
+void wake_cons(void);
 
 /*
- * wakes all proccesses waiting in "sem" queue
+ * bytes in the ring (free in it). The indices may come from user space, so
+ * it is never more than its size
  */
-void sem_broadcast(struct semaphore *sem, int *waiting);
+unsigned int ring_len(void);
+unsigned int ring_gaps(void);
+
+/*
+ * copy up to len bytes from the ring to the user (from the user to the ring)
+ * and move the index past just what could be copied. They return how much
+ * that is, and set *ret to -EFAULT if not all of it could (mtx held)
+ */
+size_t ring_get(char __user *buf, size_t len, int *ret);
+size_t ring_put(const char __user *buf, size_t len, int *ret);
 
 /*****************************************************************************
  *
@@ -81,25 +162,36 @@ void sem_broadcast(struct semaphore *sem, int *waiting);
  ****************************************************************************/
 static int fifodev_open(struct inode *inode, struct file *file) {
 
-    if (down_interruptible(&mtx)) {
+    if (mutex_lock_interruptible(&mtx)) {
         trace_printk(MODULE_NAME": Interrupted in open mutex\n");
         return -EINTR;
     }
     
-	if (file->f_mode & FMODE_READ) {
+    /* open for both, as in a pipe: a prod and a cons that waits for no one */
+    if ((file->f_mode & FMODE_READ) && (file->f_mode & FMODE_WRITE)) {
+        cons_count++;
+        prod_count++;
+        if( cons_count == 1 ) {
+            wake_up_interruptible_all(&prod_queue);
+        }
+        if( prod_count == 1 ) {
+            wake_up_interruptible_all(&cons_queue);
+        }
+        trace_printk(MODULE_NAME": PROD and CONS registered\n");
+    } else if (file->f_mode & FMODE_READ) {
 		cons_count++;
     
         /* If it is the only cons, all the possible prods must be waiting for it */
         if( cons_count == 1 ) {
-            sem_broadcast(&sem_prod, &nr_prod_waiting);
+            wake_up_interruptible_all(&prod_queue);
         }
 
         /* If there are no prods, wait for someone to come */
-        while( prod_count <= 0 ) {
-            if (sem_wait_interruptible(&sem_cons, &mtx, &nr_cons_waiting)) {
-                trace_printk(MODULE_NAME": Interrupted in open condvar\n");
-                return -EINTR;
-            }
+        if (fifo_wait(cons_queue, nr_cons_waiting, cons_need, 0, prod_count > 0)) {
+            cons_count--;
+            mutex_unlock(&mtx);
+            trace_printk(MODULE_NAME": Interrupted in open condvar\n");
+            return -EINTR;
         }
         trace_printk(MODULE_NAME": CONS registered\n");
 	} else{
@@ -107,19 +199,19 @@ static int fifodev_open(struct inode *inode, struct file *file) {
 
         /* If it is the only prod, all the possible cons must be waiting for it */
         if( prod_count == 1 ) {
-            sem_broadcast(&sem_cons, &nr_cons_waiting);
+            wake_up_interruptible_all(&cons_queue);
         }
 
          /* If there are no cons, wait for someone to come */
-        while( cons_count <= 0 ) {
-            if (sem_wait_interruptible(&sem_prod, &mtx, &nr_prod_waiting)) {
-                trace_printk(MODULE_NAME": Interrupted in open condvar\n");
-                return -EINTR;
-            }
+        if (fifo_wait(prod_queue, nr_prod_waiting, prod_need, 0, cons_count > 0)) {
+            prod_count--;
+            mutex_unlock(&mtx);
+            trace_printk(MODULE_NAME": Interrupted in open condvar\n");
+            return -EINTR;
         }
         trace_printk(MODULE_NAME": PROD registered\n");
 	}
-    up(&mtx);
+    mutex_unlock(&mtx);
 
     return 0;
 }
@@ -127,126 +219,226 @@ static int fifodev_open(struct inode *inode, struct file *file) {
 
 static int fifodev_release(struct inode *inode, struct file *file) {
 
-    if (down_interruptible(&mtx)) {
-        trace_printk(MODULE_NAME": Interrupted in release mutex\n");
-        return -EINTR;
-    }
+    /* release can not fail, the file is closed anyway */
+    mutex_lock(&mtx);
 
 	if ( file->f_mode & FMODE_READ ){
         trace_printk(MODULE_NAME": CONS unregistered\n");
 		cons_count--;
-	} else{
+	}
+	if ( file->f_mode & FMODE_WRITE ){
         trace_printk(MODULE_NAME": PROD unregistered\n");
 	    prod_count--;
 	}
 
     /* No one is using the fifo, clear its content */
     if( (cons_count == 0) && (prod_count == 0) ) {
-        kfifo_reset(&buffer);
+        WRITE_ONCE(ring->head, READ_ONCE(ring->tail));
     }    
     /* As there are no cons, wake all the waiting prods to allow them realize this situation */
     else if( cons_count == 0 ) {
-        sem_broadcast(&sem_prod, &nr_prod_waiting);
+        wake_up_interruptible_all(&prod_queue);
     }
     /* As there are no prods, wake all the waiting cons to allow them realize this situation */
     else if( prod_count == 0 ) {
-        sem_broadcast(&sem_cons, &nr_cons_waiting);
+        wake_up_interruptible_all(&cons_queue);
     }
 
-    up(&mtx);
+    mutex_unlock(&mtx);
 
     return 0;
 }
 
 
 static ssize_t fifodev_read(struct file *filp, char __user *buf, size_t len, loff_t *off) {
-    int actual_len;
-    int ret_value;
+    size_t actual_len;
+    int ret_value = 0;
 
-    if ((len > MAX_BUFF_ITEMS) || (len > MAX_KBUFF)) {
-        trace_printk(MODULE_NAME": Too much items to read\n");
-        return -ENOSPC;
+    if (len == 0) {
+        return 0;
     }
 
-    if (down_interruptible(&mtx)) {
+    if (mutex_lock_interruptible(&mtx)) {
         trace_printk(MODULE_NAME": Interrupted in read mutex\n");
         return -EINTR;
     }
 
-
-    while( kfifo_len(&buffer) < len && prod_count > 0 ) {
-        if (sem_wait_interruptible(&sem_cons, &mtx, &nr_cons_waiting)) {
-            trace_printk(MODULE_NAME": Interrupted in open condvar\n");
-            return -EINTR;
-        }
+    /* as in a pipe, wait just for something to read */
+    if (fifo_wait(cons_queue, nr_cons_waiting, cons_need, 1,
+                  ring_len() > 0 || prod_count == 0)) {
+        mutex_unlock(&mtx);
+        trace_printk(MODULE_NAME": Interrupted in read condvar\n");
+        return -EINTR;
     }
 
     /* no prods and the buffer is empty */
-    if( prod_count == 0 && kfifo_is_empty(&buffer) ) {
-        up(&mtx);
+    if( prod_count == 0 && ring_len() == 0 ) {
+        mutex_unlock(&mtx);
         trace_printk(MODULE_NAME": no prods and buff is empty\n");
         return 0;
     }
 
-    ret_value = kfifo_to_user(&buffer, buf, len, &actual_len);
+    /* take what there is, up to len */
+    actual_len = ring_get(buf, len, &ret_value);
     if (ret_value) {
-        up(&mtx);
         trace_printk(MODULE_NAME": Could not copy to user\n");
-        return ret_value;
     }
-    (*off) += actual_len;
 
-    /* Wake all prods */
-    /* it is not just a "signal" because we do not know the prod write len,
-       so it could leave gaps unwritten, and prods waiting to write*/
-    sem_broadcast(&sem_prod, &nr_prod_waiting);
+    /* Wake the prods only if the shortest of their writes fits now */
+    wake_prods();
+
+    mutex_unlock(&mtx);
 
-    up(&mtx);
+    if (actual_len == 0) {
+        return ret_value;
+    }
+    (*off) += actual_len;
     
     return actual_len;
 }
 
 
 static ssize_t fifodev_write(struct file *filp, const char __user *buf, size_t len, loff_t *off) {
-    int actual_len;
-    int ret_value;
+    size_t done = 0, need;
+    int ret_value = 0;
 
-    if (len > MAX_BUFF_ITEMS) {
-        trace_printk(MODULE_NAME": Too much items to write\n");
-        return -ENOSPC;
+    if (len == 0) {
+        return 0;
     }
 
-    if (down_interruptible(&mtx)) {
+    if (mutex_lock_interruptible(&mtx)) {
         trace_printk(MODULE_NAME": Interrupted in write mutex\n");
         return -EINTR;
     }
 
-    while( (kfifo_gaps(&buffer) < len) && (cons_count>0) ) {
-        if (sem_wait_interruptible(&sem_prod, &mtx, &nr_prod_waiting)) {
-            trace_printk(MODULE_NAME": Interrupted in open condvar\n");
-            return -EINTR;
+    while (done < len) {
+        /* the whole write if it is short, so that it is atomic */
+        need = min_t(size_t, len - done, WRITE_CHUNK);
+        if (fifo_wait(prod_queue, nr_prod_waiting, prod_need, need,
+                      ring_gaps() >= need || cons_count == 0)) {
+            trace_printk(MODULE_NAME": Interrupted in write condvar\n");
+            ret_value = -EINTR;
+            break;
+        }
+
+        if ( cons_count == 0 ) {
+            trace_printk(MODULE_NAME": No cons registered\n");
+            ret_value = -EPIPE;
+            break;
         }
+
+        /* fill all the gaps there are */
+        done += ring_put(buf + done, len - done, &ret_value);
+
+        /* Wake the cons only if the shortest of their reads can be done now */
+        wake_cons();
+
+        if (ret_value) {
+            trace_printk(MODULE_NAME": Could not copy from user\n");
+            break;
+        }
+    }
+    
+    mutex_unlock(&mtx);
+
+    /* as in a pipe, what is written counts even if the rest failed */
+    if (done == 0) {
+        return ret_value;
     }
+    (*off) += done;
+
+    return done;
+}
+
+
+/* A mapping holds the module, as the ring is freed when it is unloaded */
+static void fifodev_vm_open(struct vm_area_struct *vma) {
+    __module_get(THIS_MODULE);
+}
 
-    if ( cons_count == 0 ) {
-        up(&mtx);
-        trace_printk(MODULE_NAME": No cons registered\n");
-        return -EPIPE;
+
+static void fifodev_vm_close(struct vm_area_struct *vma) {
+    module_put(THIS_MODULE);
+}
+
+
+static const struct vm_operations_struct fifodev_vm_ops = {
+    .open = fifodev_vm_open,
+    .close = fifodev_vm_close,
+};
+
+
+static int fifodev_mmap(struct file *filp, struct vm_area_struct *vma) {
+    int ret_value;
+
+    /* the ring is written, and shared with the other prods and cons */
+    if (vma->vm_pgoff != 0 || vma->vm_end - vma->vm_start > ring_bytes ||
+        !(vma->vm_flags & VM_SHARED) || !(filp->f_mode & FMODE_WRITE)) {
+        return -EINVAL;
     }
 
-    ret_value = kfifo_from_user(&buffer, buf, len, &actual_len);
+    ret_value = remap_vmalloc_range(vma, ring, 0);
     if (ret_value) {
-        up(&mtx);
-        trace_printk(MODULE_NAME": Could not copy to user\n");
+        trace_printk(MODULE_NAME": Could not map the ring\n");
         return ret_value;
     }
-    (*off) += actual_len;
-	
-    sem_broadcast(&sem_cons, &nr_cons_waiting);
-    
-    up(&mtx);
 
-    return actual_len;
+    vma->vm_ops = &fifodev_vm_ops;
+    fifodev_vm_open(vma);
+
+    return 0;
+}
+
+
+static long fifodev_ioctl(struct file *filp, unsigned int cmd, unsigned long arg) {
+    int self_prod = (filp->f_mode & FMODE_WRITE) ? 1 : 0;
+    int self_cons = (filp->f_mode & FMODE_READ) ? 1 : 0;
+    long ret_value = 0;
+
+    if (cmd != FIFODEV_IOC_WAIT_DATA && cmd != FIFODEV_IOC_WAIT_ROOM && cmd != FIFODEV_IOC_WAKE) {
+        return -ENOTTY;
+    }
+    if (cmd != FIFODEV_IOC_WAKE && (arg == 0 || arg > ring_mask + 1)) {
+        return -EINVAL;
+    }
+
+    if (mutex_lock_interruptible(&mtx)) {
+        trace_printk(MODULE_NAME": Interrupted in ioctl mutex\n");
+        return -EINTR;
+    }
+
+    switch (cmd) {
+    case FIFODEV_IOC_WAIT_DATA:
+        /* the file itself does not count as a prod, it is the one waiting */
+        if (fifo_wait(cons_queue, nr_cons_waiting, cons_need, arg,
+                      ring_len() >= arg || prod_count == self_prod)) {
+            trace_printk(MODULE_NAME": Interrupted in ioctl condvar\n");
+            ret_value = -EINTR;
+        } else if (ring_len() < arg) {
+            ret_value = -EPIPE;
+        }
+        break;
+
+    case FIFODEV_IOC_WAIT_ROOM:
+        if (fifo_wait(prod_queue, nr_prod_waiting, prod_need, arg,
+                      ring_gaps() >= arg || cons_count == self_cons)) {
+            trace_printk(MODULE_NAME": Interrupted in ioctl condvar\n");
+            ret_value = -EINTR;
+        } else if (ring_gaps() < arg) {
+            ret_value = -EPIPE;
+        }
+        break;
+
+    case FIFODEV_IOC_WAKE:
+        /* an index moved in the mapping, the kernel did not see it */
+        wake_prods();
+        wake_cons();
+        break;
+    }
+
+    mutex_unlock(&mtx);
+
+    return ret_value;
 }
 
 
@@ -260,6 +452,9 @@ static const struct file_operations fops = {
     .release = fifodev_release,
     .read = fifodev_read,
     .write = fifodev_write,
+    .mmap = fifodev_mmap,
+    .unlocked_ioctl = fifodev_ioctl,
+    .compat_ioctl = fifodev_ioctl,
 };
 
 
@@ -271,26 +466,43 @@ static const struct file_operations fops = {
  ****************************************************************************/
 static int __init init_fifodev_module( void ) {
 
-    /* init resources */
-    INIT_KFIFO(buffer);
+    if (buffer_size < 2 || buffer_size > MAX_BUFFER_SIZE) {
+        printk(KERN_INFO MODULE_NAME": buffer_size must be 2 to %d bytes\n", MAX_BUFFER_SIZE);
+        return -EINVAL;
+    }
 
-    /* condvar-like semaphores to sync prods and cons */
-    sema_init(&sem_cons, 0);
-    sema_init(&sem_prod, 0);
+    /* init resources, the page of the ring and its data, zeroed to be mapped */
+    ring_mask = roundup_pow_of_two(buffer_size) - 1;
+    ring_bytes = PAGE_SIZE + PAGE_ALIGN(ring_mask + 1);
+    ring = vmalloc_user(ring_bytes);
+    if (ring == NULL) {
+        printk(KERN_INFO MODULE_NAME": Can't create the fifo buffer\n");
+        return -ENOMEM;
+    }
+    ring_data = (char *)ring + PAGE_SIZE;
+    ring->size = ring_mask + 1;
+    ring->data_offset = PAGE_SIZE;
+    publish_needs();
+
+    /* wait queues to sync prods and cons */
+    init_waitqueue_head(&cons_queue);
+    init_waitqueue_head(&prod_queue);
    
-    /* mutex-like semaphore for mutual exclusion */ 
-    sema_init(&mtx, 1);
+    /* mutex for mutual exclusion */ 
+    mutex_init(&mtx);
 
 
     /* create module entry */
     major_number = register_chrdev(0, MODULE_NAME, &fops);
     if (major_number < 0) {
+        vfree(ring);
         printk(KERN_ALERT MODULE_NAME": failed to register a major number\n");
         return major_number;
     }
 
     char_class = class_create(THIS_MODULE, CLASS_NAME);
     if(IS_ERR(char_class)) {
+        vfree(ring);
         unregister_chrdev(major_number, MODULE_NAME);
         printk(KERN_ALERT MODULE_NAME": failed to register device class\n");
         return PTR_ERR(char_class);
@@ -298,6 +510,7 @@ static int __init init_fifodev_module( void ) {
 
     char_device = device_create(char_class, NULL, MKDEV(major_number, 0), NULL, MODULE_NAME);
     if (IS_ERR(char_device)) {
+        vfree(ring);
         class_destroy(char_class);
         unregister_chrdev(major_number, MODULE_NAME);
         printk(KERN_ALERT MODULE_NAME": failed to create the device\n");
@@ -319,7 +532,8 @@ static void __exit cleanup_fifodev_module( void ) {
     class_destroy(char_class);
     unregister_chrdev(major_number, MODULE_NAME);
 
-    /* as the fifo is not dinamically allocated, there is no resources to free */
+    /* free resources */
+    vfree(ring);
 
     trace_printk(MODULE_NAME": MODULE UNLOADED =========\n");
     printk(KERN_INFO MODULE_NAME": Module unloaded.\n");
@@ -332,45 +546,76 @@ module_exit( cleanup_fifodev_module );
 
 /*****************************************************************************
  *
- * Semaphore-based syncronization functions
+ * Wait queue based syncronization functions
  *
  ****************************************************************************/
-int sem_wait_interruptible(struct semaphore *sem, struct semaphore *mutex, int *waiting) {
-
-    (*waiting)++;
-    
-    /* release the mutex */
-    up(mutex);
-
-    /* wait to be waken */
-    if (down_interruptible(sem)) {
-        down(mutex);
-        (*waiting)--;
-        up(mutex);
-        return -1;
+void wake_prods(void) {
+    if (nr_prod_waiting > 0 && ring_gaps() >= prod_need) {
+        wake_up_interruptible(&prod_queue);
     }
+}
+
 
-    /* get the mutex */
-    if (down_interruptible(mutex)) {
-        return -1;
+void wake_cons(void) {
+    if (nr_cons_waiting > 0 && ring_len() >= cons_need) {
+        wake_up_interruptible(&cons_queue);
     }
+}
 
-    return 0;
+
+
+/*****************************************************************************
+ *
+ * Shared ring functions
+ *
+ ****************************************************************************/
+unsigned int ring_len(void) {
+    unsigned int tail = smp_load_acquire(&ring->tail);
+    unsigned int head = smp_load_acquire(&ring->head);
+
+    return min(tail - head, ring_mask + 1);
 }
 
 
-void sem_signal(struct semaphore *sem, int *waiting) {
-    if (*waiting > 0) {
-        up(sem);
-        (*waiting)--;
-    }
+unsigned int ring_gaps(void) {
+    return ring_mask + 1 - ring_len();
 }
 
 
-void sem_broadcast(struct semaphore *sem, int *waiting) {
-    while (*waiting > 0) {
-        up(sem);
-        (*waiting)--;
+size_t ring_get(char __user *buf, size_t len, int *ret) {
+    unsigned int head = READ_ONCE(ring->head);
+    size_t total = min_t(size_t, len, ring_len());
+    size_t done = 0, piece;
+
+    /* up to the end of the data, then from its start */
+    while (done < total) {
+        piece = min_t(size_t, total - done, ring_mask + 1 - ((head + done) & ring_mask));
+        if (copy_to_user(buf + done, ring_data + ((head + done) & ring_mask), piece)) {
+            *ret = -EFAULT;
+            break;
+        }
+        done += piece;
     }
+
+    smp_store_release(&ring->head, head + done);
+    return done;
 }
 
+
+size_t ring_put(const char __user *buf, size_t len, int *ret) {
+    unsigned int tail = READ_ONCE(ring->tail);
+    size_t total = min_t(size_t, len, ring_gaps());
+    size_t done = 0, piece;
+
+    while (done < total) {
+        piece = min_t(size_t, total - done, ring_mask + 1 - ((tail + done) & ring_mask));
+        if (copy_from_user(ring_data + ((tail + done) & ring_mask), buf + done, piece)) {
+            *ret = -EFAULT;
+            break;
+        }
+        done += piece;
+    }
+
+    smp_store_release(&ring->tail, tail + done);
+    return done;
+}
@@ -0,0 +1,51 @@
+#ifndef FIFODEV_IOCTL_H
+#define FIFODEV_IOCTL_H
+
+/*
+ * Binary interface of /dev/fifodev, shared by the module and the user
+ * programs that map its ring.
+ */
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/*
+ * mmap() at offset 0, shared, maps the same ring read and write use:
+ *   page 0:            struct fifodev_ring
+ *   data_offset-:      the data, size bytes
+ * head and tail run free: the byte of index i is data[i & (size-1)] and the
+ * ring holds tail-head bytes. The prod stores the data and then tail, with a
+ * release barrier, and reads head with an acquire one. The cons the same with
+ * head. Only one prod and one cons may move the indices at a time, the read
+ * and write of other files included.
+ *
+ * After moving its index, and a full barrier, a side wakes the other with
+ * FIFODEV_IOC_WAKE if it made what that one waits for:
+ *   tail-head >= cons_need            after moving tail
+ *   size-(tail-head) >= prod_need     after moving head
+ * The mapping needs a file open for read and write, which is a prod and a
+ * cons at the same time, as in a pipe.
+ */
+struct fifodev_ring {
+    __u32 size;         /* Bytes of data, a power of 2 */
+    __u32 data_offset;  /* Offset of the data in the mapping, a page */
+    __u32 prod_need;    /* Shortest wait of the prods for room, ~0U if none waits */
+    __u32 cons_need;    /* Shortest wait of the cons for data, ~0U if none waits */
+    __u32 pad0[12];
+    __u32 head;         /* Index of the first byte, moved by the cons */
+    __u32 pad1[15];
+    __u32 tail;         /* Index past the last byte, moved by the prod */
+    __u32 pad2[15];
+};
+
+/*
+ * Doorbell. The waits take the bytes (room) needed, from 1 to size, and
+ * return 0 once they are there, or EPIPE if there are no prods (cons) but the
+ * file itself and they are not
+ */
+#define FIFODEV_IOC_MAGIC       'f'
+#define FIFODEV_IOC_WAIT_DATA   _IO(FIFODEV_IOC_MAGIC, 1)
+#define FIFODEV_IOC_WAIT_ROOM   _IO(FIFODEV_IOC_MAGIC, 2)
+#define FIFODEV_IOC_WAKE        _IO(FIFODEV_IOC_MAGIC, 3)
+
+#endif
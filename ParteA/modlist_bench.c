@@ -0,0 +1,514 @@
+/*=====================================================================================
+    PROGRAM: modlist_bench
+
+    DESCRIPTION:
+        Multithreaded benchmark and correctness check of /proc/modlist. It
+        runs writer, reader, sort and remove threads against the list at once,
+        reports the throughput and latency percentiles of every command and
+        verifies the list afterwards.
+
+    USAGE:
+        make bench      (against the loaded module)
+        make ubench     (./modlist_ubench, the module built in, see ucompat/)
+        ./modlist_bench [-w writers] [-n adds] [-r readers] [-s sorters]
+                        [-d removers] [-v values] [-f file]
+
+        -w  writer threads, every one adds -n distinct values (4, 10000)
+        -r  reader threads, reading the whole list until the writers end (2)
+        -s  sort threads, writing sort until the writers end (1)
+        -d  remove threads, removing the -v values added before the start (1, 1000)
+        -f  list to test (/proc/modlist, or one in /proc/modlists)
+
+    CHECKS:
+        No read of the whole list holds a value that was never added, and once
+        every thread ends the list holds every added value exactly once, none
+        of the removed ones and nothing else. The exit status is 1 if any
+        fails. The reads that hold a value twice are counted too: the list
+        kept changing under them, and they were read a page at a time through
+        seq_file instead of from the cached text.
+=====================================================================================
+*/
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef UCOMPAT
+/* The module is part of this program, its /proc entries are reached through ucompat */
+#include "ucompat_user.h"
+#define file_open       ucompat_open
+#define file_read       ucompat_read
+#define file_write      ucompat_write
+#define file_close      ucompat_close
+#else
+#define file_open       open
+#define file_read       read
+#define file_write      write
+#define file_close      close
+#endif
+
+#define READ_CHUNK      65536
+#define CMD_LENGHT      32
+
+enum { OP_ADD, OP_READ, OP_SORT, OP_REMOVE, NR_OPS };
+
+static const char *op_names[NR_OPS] = { "add", "read", "sort", "remove" };
+
+/* Latencies of one thread, in nanoseconds */
+typedef struct {
+    uint64_t *ns;
+    size_t nr, cap;
+}samples_t;
+
+typedef struct {
+    pthread_t tid;
+    int op;
+    int index;                  // among the threads of op
+    samples_t samples;
+    unsigned long bad_reads;    // reads with an unknown value
+    unsigned long torn_reads;   // reads with a repeated value
+    int failed;                 // a command could not be written
+}worker_t;
+
+/* Options */
+static int nr_writers = 4, nr_readers = 2, nr_sorters = 1, nr_removers = 1;
+static long nr_adds = 10000, nr_victims = 1000;
+static const char *path = "/proc/modlist";
+
+/* Set once the writers and removers end, the readers and sorters stop with it */
+static volatile int stop;
+
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void samples_push(samples_t *s, uint64_t ns) {
+    if (s->nr == s->cap) {
+        s->cap = s->cap ? s->cap * 2 : 1024;
+        s->ns = realloc(s->ns, s->cap * sizeof(uint64_t));
+        if (s->ns == NULL) {
+            perror("realloc");
+            exit(2);
+        }
+    }
+    s->ns[s->nr++] = ns;
+}
+
+/* Writes a single command, timing it */
+static int run_command(int fd, const char *cmd, samples_t *s) {
+    size_t len = strlen(cmd);
+    uint64_t start = now_ns();
+
+    if (file_write(fd, cmd, len) != (ssize_t)len)
+        return -1;
+    samples_push(s, now_ns() - start);
+
+    return 0;
+}
+
+/*
+ * Values 0 to writers * adds - 1 are added by the writers, -1 to -victims
+ * before the start and removed by the removers. Returns the slot of value in
+ * a table of both, -1 if it is none of them.
+ */
+static long value_slot(long value) {
+    if (value >= 0 && value < nr_writers * nr_adds)
+        return value;
+    if (value < 0 && value >= -nr_victims)
+        return nr_writers * nr_adds - value - 1;
+    return -1;
+}
+
+/* Reads the whole list into *buf, growing it as needed. Returns its length */
+static ssize_t read_list(const char *file, char **buf, size_t *size) {
+    size_t len = 0;
+    ssize_t n;
+    int fd;
+
+    fd = file_open(file, O_RDONLY);
+    if (fd < 0)
+        return -1;
+
+    for (;;) {
+        if (*size - len < READ_CHUNK) {
+            *size = *size * 2 + READ_CHUNK;
+            *buf = realloc(*buf, *size);
+            if (*buf == NULL) {
+                perror("realloc");
+                exit(2);
+            }
+        }
+        n = file_read(fd, *buf + len, READ_CHUNK);
+        if (n < 0) {
+            file_close(fd);
+            return -1;
+        }
+        if (n == 0)
+            break;
+        len += n;
+    }
+    file_close(fd);
+
+    return len;
+}
+
+/*
+ * Counts the values of a read of the list in seen, tagging them with stamp
+ * so the table does not need to be cleared between reads. Returns the number
+ * of unknown values, and the repeated ones in *repeated.
+ */
+static unsigned long check_read(char *text, size_t len, uint32_t *seen, uint32_t stamp, unsigned long *repeated) {
+    unsigned long bad = 0;
+    char *p = text, *end = text + len, *next;
+    long value, slot;
+
+    while (p < end) {
+        value = strtol(p, &next, 10);
+        if (next == p)
+            break;
+        p = next + 1;
+
+        slot = value_slot(value);
+        if (slot < 0)
+            bad++;
+        else if (seen[slot] == stamp)
+            (*repeated)++;
+        else
+            seen[slot] = stamp;
+    }
+
+    return bad;
+}
+
+
+static void *writer(void *arg) {
+    worker_t *w = arg;
+    char cmd[CMD_LENGHT];
+    long i;
+    int fd;
+
+    fd = file_open(path, O_WRONLY);
+    if (fd < 0) {
+        w->failed = 1;
+        return NULL;
+    }
+
+    for (i = 0; i < nr_adds; i++) {
+        snprintf(cmd, sizeof(cmd), "add %ld\n", w->index * nr_adds + i);
+        if (run_command(fd, cmd, &w->samples)) {
+            w->failed = 1;
+            break;
+        }
+    }
+    file_close(fd);
+
+    return NULL;
+}
+
+/* Removes every value -1 - k with k % removers == index */
+static void *remover(void *arg) {
+    worker_t *w = arg;
+    char cmd[CMD_LENGHT];
+    long k;
+    int fd;
+
+    fd = file_open(path, O_WRONLY);
+    if (fd < 0) {
+        w->failed = 1;
+        return NULL;
+    }
+
+    for (k = w->index; k < nr_victims; k += nr_removers) {
+        snprintf(cmd, sizeof(cmd), "remove %ld\n", -1 - k);
+        if (run_command(fd, cmd, &w->samples)) {
+            w->failed = 1;
+            break;
+        }
+    }
+    file_close(fd);
+
+    return NULL;
+}
+
+static void *sorter(void *arg) {
+    worker_t *w = arg;
+    int fd;
+
+    fd = file_open(path, O_WRONLY);
+    if (fd < 0) {
+        w->failed = 1;
+        return NULL;
+    }
+
+    while (!stop) {
+        if (run_command(fd, "sort\n", &w->samples)) {
+            w->failed = 1;
+            break;
+        }
+    }
+    file_close(fd);
+
+    return NULL;
+}
+
+static void *reader(void *arg) {
+    worker_t *w = arg;
+    size_t slots = nr_writers * nr_adds + nr_victims;
+    uint32_t *seen, stamp = 0;
+    char *buf = NULL;
+    size_t size = 0;
+    ssize_t len;
+    uint64_t start;
+    unsigned long repeated;
+
+    seen = calloc(slots, sizeof(uint32_t));
+    if (seen == NULL) {
+        w->failed = 1;
+        return NULL;
+    }
+
+    while (!stop) {
+        start = now_ns();
+        len = read_list(path, &buf, &size);
+        if (len < 0) {
+            w->failed = 1;
+            break;
+        }
+        samples_push(&w->samples, now_ns() - start);
+
+        repeated = 0;
+        if (check_read(buf, len, seen, ++stamp, &repeated))
+            w->bad_reads++;
+        if (repeated)
+            w->torn_reads++;
+    }
+
+    free(seen);
+    free(buf);
+
+    return NULL;
+}
+
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+/* Prints the throughput and percentiles of op, merging the samples of its threads */
+static void report(int op, worker_t *workers, int nr, double seconds) {
+    samples_t all = { NULL, 0, 0 };
+    size_t i, j;
+
+    for (i = 0; i < nr; i++) {
+        if (workers[i].op != op)
+            continue;
+        for (j = 0; j < workers[i].samples.nr; j++)
+            samples_push(&all, workers[i].samples.ns[j]);
+    }
+    if (all.nr == 0)
+        return;
+
+    qsort(all.ns, all.nr, sizeof(uint64_t), cmp_u64);
+    printf(" %-8s %10zu %12.0f %10.1f %10.1f %10.1f\n", op_names[op], all.nr, all.nr / seconds,
+           all.ns[(all.nr - 1) * 50 / 100] / 1000.0,
+           all.ns[(all.nr - 1) * 99 / 100] / 1000.0,
+           all.ns[(all.nr - 1) * 999 / 1000] / 1000.0);
+    free(all.ns);
+}
+
+/* Checks the final list: every added value once, no removed value, nothing else */
+static int check_final(void) {
+    size_t slots = nr_writers * nr_adds + nr_victims;
+    unsigned char *count;
+    unsigned long items = 0, missing = 0, repeated = 0, kept = 0, unknown = 0;
+    char *buf = NULL, *p, *end, *next;
+    size_t size = 0, i;
+    ssize_t len;
+    long value, slot;
+
+    len = read_list(path, &buf, &size);
+    count = calloc(slots, 1);
+    if (len < 0 || count == NULL) {
+        fprintf(stderr, " Can't read %s\n", path);
+        return -1;
+    }
+
+    for (p = buf, end = buf + len; p < end; p = next + 1) {
+        value = strtol(p, &next, 10);
+        if (next == p)
+            break;
+        items++;
+        slot = value_slot(value);
+        if (slot < 0)
+            unknown++;
+        else if (count[slot] < 255)
+            count[slot]++;
+    }
+
+    for (i = 0; i < slots; i++) {
+        if (i < nr_writers * nr_adds) {
+            missing += (count[i] == 0);
+            repeated += (count[i] > 1);
+        } else {
+            kept += (count[i] > 0);
+        }
+    }
+
+    printf("   final list: %lu items, missing %lu, repeated %lu, removed but present %lu, unknown %lu\n",
+           items, missing, repeated, kept, unknown);
+
+    free(count);
+    free(buf);
+
+    return (missing || repeated || kept || unknown || items != nr_writers * nr_adds) ? -1 : 0;
+}
+
+/* Empties the list and adds the values the removers will take out */
+static int prepare(void) {
+    char cmd[CMD_LENGHT];
+    long k;
+    int fd, ret = 0;
+
+    fd = file_open(path, O_WRONLY);
+    if (fd < 0)
+        return -1;
+
+    if (file_write(fd, "cleanup\n", 8) != 8)
+        ret = -1;
+    for (k = 0; k < nr_victims && ret == 0; k++) {
+        snprintf(cmd, sizeof(cmd), "add %ld\n", -1 - k);
+        if (file_write(fd, cmd, strlen(cmd)) != (ssize_t)strlen(cmd))
+            ret = -1;
+    }
+    file_close(fd);
+
+    return ret;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [-w writers] [-n adds] [-r readers] [-s sorters]"
+                    " [-d removers] [-v values] [-f file]\n", name);
+    exit(2);
+}
+
+int main(int argc, char *argv[]) {
+    worker_t *workers;
+    int nr, i, j, opt, errors = 0;
+    unsigned long bad_reads = 0, torn_reads = 0;
+    uint64_t start, end;
+    double seconds;
+
+    while ((opt = getopt(argc, argv, "w:n:r:s:d:v:f:")) != -1) {
+        switch (opt) {
+        case 'w': nr_writers = atoi(optarg); break;
+        case 'n': nr_adds = atol(optarg); break;
+        case 'r': nr_readers = atoi(optarg); break;
+        case 's': nr_sorters = atoi(optarg); break;
+        case 'd': nr_removers = atoi(optarg); break;
+        case 'v': nr_victims = atol(optarg); break;
+        case 'f': path = optarg; break;
+        default: usage(argv[0]);
+        }
+    }
+    if (nr_writers < 1 || nr_adds < 1 || nr_readers < 0 || nr_sorters < 0 ||
+        nr_removers < 0 || nr_victims < 0)
+        usage(argv[0]);
+    if (nr_removers == 0)
+        nr_victims = 0;
+
+#ifdef UCOMPAT
+    if (ucompat_load()) {
+        fprintf(stderr, " Can't load the module: %s\n", strerror(errno));
+        return 2;
+    }
+#endif
+
+    if (prepare()) {
+        fprintf(stderr, " Can't write %s: %s\n", path, strerror(errno));
+        return 2;
+    }
+
+    nr = nr_writers + nr_readers + nr_sorters + nr_removers;
+    workers = calloc(nr, sizeof(worker_t));
+    if (workers == NULL)
+        return 2;
+
+    printf(" %s: %d writers x %ld adds, %d readers, %d sorters, %d removers x %ld values\n",
+           path, nr_writers, nr_adds, nr_readers, nr_sorters, nr_removers,
+           nr_removers ? nr_victims / nr_removers : 0);
+
+    for (i = 0, j = 0; i < nr; i++, j++) {
+        if (i == nr_writers || i == nr_writers + nr_readers ||
+            i == nr_writers + nr_readers + nr_sorters)
+            j = 0;
+        workers[i].op = i < nr_writers ? OP_ADD :
+                        i < nr_writers + nr_readers ? OP_READ :
+                        i < nr_writers + nr_readers + nr_sorters ? OP_SORT : OP_REMOVE;
+        workers[i].index = j;
+    }
+
+    start = now_ns();
+    for (i = 0; i < nr; i++) {
+        void *(*fn)(void *) = workers[i].op == OP_ADD ? writer :
+                              workers[i].op == OP_READ ? reader :
+                              workers[i].op == OP_SORT ? sorter : remover;
+        if (pthread_create(&workers[i].tid, NULL, fn, &workers[i])) {
+            perror("pthread_create");
+            return 2;
+        }
+    }
+
+    // the writers and removers end by themselves, then the rest is stopped
+    for (i = 0; i < nr; i++) {
+        if (workers[i].op == OP_ADD || workers[i].op == OP_REMOVE)
+            pthread_join(workers[i].tid, NULL);
+    }
+    end = now_ns();
+    stop = 1;
+    for (i = 0; i < nr; i++) {
+        if (workers[i].op == OP_READ || workers[i].op == OP_SORT)
+            pthread_join(workers[i].tid, NULL);
+    }
+    seconds = (end - start) / 1e9;
+
+    printf(" %-8s %10s %12s %10s %10s %10s\n", "command", "ops", "ops/sec", "p50 us", "p99 us", "p999 us");
+    for (i = 0; i < NR_OPS; i++)
+        report(i, workers, nr, seconds);
+
+    printf(" checks:\n");
+    for (i = 0; i < nr; i++) {
+        bad_reads += workers[i].bad_reads;
+        torn_reads += workers[i].torn_reads;
+        if (workers[i].failed) {
+            printf("   %s thread %d could not write or read %s\n",
+                   op_names[workers[i].op], workers[i].index, path);
+            errors++;
+        }
+        free(workers[i].samples.ns);
+    }
+    printf("   reads with unknown values: %lu\n", bad_reads);
+    printf("   reads with repeated values (through seq_file): %lu\n", torn_reads);
+    errors += (bad_reads > 0);
+    errors += (check_final() != 0);
+
+    printf(" %s\n", errors ? "FAILED" : "PASSED");
+    free(workers);
+
+#ifdef UCOMPAT
+    ucompat_unload();
+#endif
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,46 @@
+#ifndef MODLIST_IOCTL_H
+#define MODLIST_IOCTL_H
+
+/*
+ * Binary interface of /proc/modlist and /proc/modlist_snap (integer builds
+ * only), shared by the module and the user programs that open them.
+ */
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/* Bulk commands */
+#define MODLIST_BULK_ADD        0   /* Append the values, in order */
+#define MODLIST_BULK_REMOVE     1   /* Remove every occurrence of each value */
+#define MODLIST_BULK_REPLACE    2   /* The values become the whole list */
+
+/* Maximum number of values of a single call */
+#define MODLIST_BULK_MAX        (1 << 24)
+
+struct modlist_bulk {
+    __u32 cmd;          /* MODLIST_BULK_* */
+    __u32 count;        /* Number of values */
+    __u64 values;       /* User pointer to count __s32 values */
+};
+
+#define MODLIST_IOC_MAGIC       'm'
+#define MODLIST_IOC_BULK        _IOW(MODLIST_IOC_MAGIC, 1, struct modlist_bulk)
+
+/*
+ * /proc/modlist_snap. Every open file gets a snapshot of the list, rendered
+ * again only if the list changed. read() returns its header, and mmap() at
+ * offset 0 maps, read only:
+ *   page 0:  struct modlist_snap_live, updated on every list change
+ *   page 1-: struct modlist_snap_header, followed by count __s32 values
+ * The snapshot is stale when live->gen != header->gen.
+ */
+struct modlist_snap_live {
+    __u64 gen;          /* Generation of the list right now */
+};
+
+struct modlist_snap_header {
+    __u64 gen;          /* Generation of the list in the snapshot */
+    __u64 count;        /* Number of values */
+};
+
+#endif
@@ -0,0 +1,3479 @@
+/*=====================================================================================
+    MODULE: modlist
+
+    DESCRIPTION:
+        Maintains a kernel linked list of integers
+
+    USAGE:
+        echo add <number> > /proc/modlist       inserts <number> at the end
+        echo remove <number> > /proc/modlist    remove all ocurrences of <number>
+        cat /proc/modlist                       prints the whole list
+        echo cleanup > /proc/modlist            delete the list content
+        cat commands.txt > /proc/modlist        runs every command in the file, one per line
+        count, contains <number>, occurrences <number>, min, max, sum
+                                                queries, each one answers a line that
+                                                the next read of the same open file
+                                                returns (sum is not in STRING_MODE):
+                                                exec 3<> /proc/modlist
+                                                echo count >&3; cat <&3
+        cat /proc/modlist_pool                  prints the node pool usage
+        cat /proc/modlist_stats                 prints operation counts, latencies
+                                                and write lock times
+        ioctl(fd, MODLIST_IOC_BULK, &bulk)      adds, removes or replaces a whole
+                                                array of int32 (modlist_ioctl.h)
+        mmap of /proc/modlist_snap              maps a read only int32 snapshot of
+                                                the list (modlist_ioctl.h)
+        echo create <name> > /proc/modlists/control
+                                                adds another list, /proc/modlists/<name>
+                                                (and <name>.snap), with the same commands
+        echo delete <name> > /proc/modlists/control
+                                                deletes it with its content
+        cat /proc/modlists/control              prints every named list and its size
+
+    CONDITIONAL COMPILATION
+        STRING_MODE
+            If defined, the list contains string values, if not, integer values.
+            The strings are allocated to fit, and the equal ones are stored
+            once unless the intern module parameter is cleared.
+        TEST_NO_LOCK
+            If defined, the spin locks are not used, to test the failures it causes.
+        RCU_MODE
+            If defined, readers walk the list under rcu_read_lock only, and the
+            writers serialize among themselves on a mutex. sort and cleanup
+            publish a new list head instead of relinking the nodes in place.
+        RBTREE_MODE
+            If defined, the items are kept in a red-black tree ordered by value,
+            with one node and a count for every distinct value. Reads always come
+            out sorted and sort does nothing. It can not be used with RCU_MODE.
+        ARRAY_MODE
+            If defined, the integers are packed in a growable vmalloc'ed array,
+            4 bytes each. remove compacts the array in one pass and sort uses
+            the kernel sort(). It can only be used alone or with TEST_NO_LOCK.
+        STAGED_ADD
+            If defined, add pushes its node to a lockless list (llist) instead
+            of taking the write lock. The staged nodes are linked, in the order
+            every writer added them, before any other command or read. It only
+            works with the list storage.
+
+    COMMENTARIES
+        Compiling with TEST_NO_LOCK does not show the expected failures either...
+        The list is read through seq_file, so it can be of any size.
+        The text of the whole list is kept once rendered, tagged with list_gen,
+        and every open file reads a snapshot of it with a straight copy. adds
+        append to it (except in RBTREE_MODE), anything else makes the next read
+        render it again. Lists whose text is larger than the render_max module
+        parameter are not cached, they are read through seq_file. The text is
+        sized from the item count and the chars per item of the last render,
+        and a list_gen found too large is not rendered again. It is rendered a
+        page per read lock acquisition, and walked again if the list changes
+        before it is done.
+        /proc/modlist_snap (not in STRING_MODE) gives every open file a packed
+        snapshot of the values, built when it is opened after a change, and lets
+        it be mapped instead of read.
+        The statistics are per CPU counters and log2 histograms of nanoseconds,
+        added up when /proc/modlist_stats is read.
+        add, remove, cleanup, sort, read and the bulk ioctl are static
+        tracepoints (modlist_trace.h), events/modlist/ in tracefs. They cost
+        nothing until enabled.
+        Writes may hold many commands, one per line, of any total size. A line
+        split between two writes is kept until the rest arrives, and the last
+        one is run on close even without '\n'. Every batch of parsed commands
+        is applied under a single write lock acquisition.
+        The bulk ioctl (not in STRING_MODE) allocates all the nodes before taking
+        the lock, and links them to the list with a single splice.
+        The nodes are taken from a pool of page sized chunks (nodepool.c), instead
+        of spending a whole vmalloc'ed page in every one of them.
+        A hash index keeps, for every distinct value, the nodes that hold it, so
+        remove does not walk the whole list. Its size is set with the index_bits
+        module parameter. RBTREE_MODE needs no index, add and remove are
+        O(log n) lookups in the tree. ARRAY_MODE needs neither the index nor
+        the pool.
+        sort remembers how much of the list is already sorted, and only sorts
+        what was appended after it, merging both in a single pass. A sort of
+        a sorted list changes nothing. RBTREE_MODE is always sorted.
+        The integer list is sorted with an LSD radix sort, one pass for every
+        byte where the values differ.
+        In STRING_MODE the nodes point to their string, which carries the length
+        and the hash of its casefolded text, so most different values are told
+        apart without strcasecmp. The strings are taken when the command is
+        parsed, outside the write lock, and dropped with the last node.
+        Every list (modlist_t) has its own lock, pools, index and caches, so the
+        commands on different lists never wait for each other. /proc/modlist is
+        the default list, it can not be deleted. The names are up to 31 letters,
+        digits, '_' or '-'. The statistics, and the strings in STRING_MODE, are
+        shared by all the lists.
+        The queries are answered from aggregates every change keeps up to date:
+        the item count, the sum and the occurrences in every index entry. The
+        index entries are also linked in an rbtree in order of their value, and
+        min and max are its ends, O(log n) like in RBTREE_MODE. ARRAY_MODE finds
+        min and max again in the pass of every remove, and counts occurrences
+        with binary searches over the sorted prefix and a scan of the rest, the
+        scan is O(tail) until a sort. min and max of an empty list answer an
+        empty line.
+=======================================================================================
+*/
+
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <linux/vmalloc.h>
+#include <linux/list.h>
+#include <linux/list_sort.h>
+#include <linux/string.h>
+#include <asm-generic/uaccess.h>
+#include <linux/spinlock.h>
+#include <linux/slab.h>
+#include <linux/hash.h>
+#include <linux/ctype.h>
+#include <linux/percpu.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/mutex.h>
+#ifdef RCU_MODE
+#include <linux/rculist.h>
+#endif
+#if !defined(ARRAY_MODE)
+#include <linux/rbtree.h>
+#endif
+#if defined(RBTREE_MODE) || defined(ARRAY_MODE)
+#include <linux/sort.h>
+#endif
+#ifdef ARRAY_MODE
+#include <linux/bsearch.h>
+#endif
+#ifdef STAGED_ADD
+#include <linux/llist.h>
+#endif
+#ifndef STRING_MODE
+#include <linux/mm.h>
+#endif
+#include "nodepool.h"
+#include "modlist_ioctl.h"
+
+#define CREATE_TRACE_POINTS
+#include "modlist_trace.h"
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Modlist kernel module - FDI-UCM");
+MODULE_AUTHOR("Daniel Pinto, Javier Bermudez");
+
+
+#if defined(RCU_MODE) && defined(TEST_NO_LOCK)
+ #error "RCU_MODE and TEST_NO_LOCK can not be used together"
+#endif
+
+#if defined(RCU_MODE) && defined(RBTREE_MODE)
+ #error "RCU_MODE and RBTREE_MODE can not be used together"
+#endif
+
+#if defined(ARRAY_MODE) && (defined(STRING_MODE) || defined(RCU_MODE) || defined(RBTREE_MODE))
+ #error "ARRAY_MODE can not be used with STRING_MODE, RCU_MODE or RBTREE_MODE"
+#endif
+
+/* The default storage, a linked list of nodes */
+#if !defined(RBTREE_MODE) && !defined(ARRAY_MODE)
+ #define LIST_MODE
+#endif
+
+#if defined(STAGED_ADD) && !defined(LIST_MODE)
+ #error "STAGED_ADD can not be used with RBTREE_MODE or ARRAY_MODE"
+#endif
+
+/* Every list has a lock of its own (modlist_t) */
+#if defined(TEST_NO_LOCK)
+ #define list_read_lock(ml)         ((void)(ml))
+ #define list_read_unlock(ml)       ((void)(ml))
+ #define __list_write_lock(ml)      ((void)(ml))
+ #define __list_write_unlock(ml)    ((void)(ml))
+#elif defined(RCU_MODE)
+ #define list_read_lock(ml)         rcu_read_lock()
+ #define list_read_unlock(ml)       rcu_read_unlock()
+ #define __list_write_lock(ml)      mutex_lock(&(ml)->wmtx)
+ #define __list_write_unlock(ml)    mutex_unlock(&(ml)->wmtx)
+#else
+ #define list_read_lock(ml)         read_lock(&(ml)->sp)
+ #define list_read_unlock(ml)       read_unlock(&(ml)->sp)
+ #define __list_write_lock(ml)      write_lock(&(ml)->sp)
+ #define __list_write_unlock(ml)    write_unlock(&(ml)->sp)
+#endif
+
+/* Operations timed in /proc/modlist_stats */
+enum { STAT_ADD, STAT_REMOVE, STAT_CLEANUP, STAT_SORT, STAT_READ, STAT_BULK,
+       STAT_QUERY, STAT_LOCK_WAIT, STAT_LOCK_HOLD, NR_STATS };
+
+#define STATS_BUCKETS   40      // log2 of the nanoseconds, the last one takes the rest
+
+/* Per CPU, so counting does not make the writers share cache lines */
+typedef struct {
+    unsigned long count[NR_STATS];
+    u64 ns[NR_STATS];
+    unsigned long hist[NR_STATS][STATS_BUCKETS];
+}modlist_stats_t;
+
+static DEFINE_PER_CPU(modlist_stats_t, modlist_stats);
+
+static inline void stats_record(int stat, u64 ns) {
+    this_cpu_inc(modlist_stats.count[stat]);
+    this_cpu_add(modlist_stats.ns[stat], ns);
+    this_cpu_inc(modlist_stats.hist[stat][min_t(int, fls64(ns), STATS_BUCKETS - 1)]);
+}
+
+/* Link operations, the RCU ones let readers walk the list while it changes */
+#ifdef RCU_MODE
+ #define item_add_tail(new, head)   list_add_tail_rcu(new, head)
+ #define item_del(entry)            list_del_rcu(entry)
+ #define item_next(entry)           rcu_dereference(list_next_rcu(entry))
+#else
+ #define item_add_tail(new, head)   list_add_tail(new, head)
+ #define item_del(entry)            list_del(entry)
+ #define item_next(entry)           ((entry)->next)
+ #define item_splice_tail(list, head) list_splice_tail(list, head)
+#endif
+
+
+#define BUFFER_LENGHT   50
+#define LINE_LENGHT     BUFFER_LENGHT
+#define WRITE_CHUNK     PAGE_SIZE
+#define BATCH_LENGHT    64
+#define BULK_CHUNK      PAGE_SIZE
+#define READ_BUFFER_LENGHT 200
+#define ANSWER_LENGHT   512
+#define POOL_INFO_LENGHT 800
+
+#define INDEX_MIN_BITS 4
+#define INDEX_MAX_BITS 24
+
+#define ARRAY_MIN_CAP   1024
+
+#define RADIX_BITS      8
+#define RADIX_MIN       64      // shorter lists are sorted with list_sort
+
+#define RENDER_MIN_SIZE PAGE_SIZE
+#define RENDER_ITEM_CHARS 8     // guess of the chars of an item, until a render measures them
+#define RENDER_TRIES 4          // walks of a render, while the list changes under them
+
+#define NAME_LENGHT     32
+#define CONTROL_LENGHT  64
+
+#ifdef STRING_MODE
+ #define STRING_LENGHT 50
+#endif
+
+#ifdef STRING_MODE
+ #define INTERN_BITS 12
+#endif
+
+#ifdef STRING_MODE
+ #define DATA_PRINT_FORMAT "%s"
+ #define DATA_PRINT_ARG(value) ((value)->text)
+#else
+ #define DATA_PRINT_FORMAT "%d"
+ #define DATA_PRINT_ARG(value) (value)
+#endif
+
+#ifdef STRING_MODE
+/*
+ * String value, allocated to fit. hash is of the casefolded text, so values
+ * equal for strcasecmp always have the same hash and len. Every string is in
+ * the intern table, and an interned one is shared by all the equal texts.
+ */
+typedef struct {
+    struct hlist_node hnode;    // link in the intern table
+    int refs;                   // nodes and commands holding it (intern_lock)
+    u32 hash;
+    u32 len;
+    char text[];
+}mstring_t;
+#endif
+
+/* Values are compared as remove does: strings ignoring the case */
+#ifdef STRING_MODE
+typedef const mstring_t *value_t;
+ #define same_value(a, b) ((a) == (b) || \
+    ((a)->hash == (b)->hash && (a)->len == (b)->len && !strcasecmp((a)->text, (b)->text)))
+ #define compare_value(a, b) ((a) == (b) ? 0 : strcasecmp((a)->text, (b)->text))
+#else
+typedef int value_t;
+ #define same_value(a, b) ((a) == (b))
+ #define compare_value(a, b) (((a) > (b)) - ((a) < (b)))
+#endif
+
+
+static struct proc_dir_entry *proc_entry;
+static struct proc_dir_entry *pool_proc_entry;
+static struct proc_dir_entry *stats_proc_entry;
+#ifndef STRING_MODE
+static struct proc_dir_entry *snap_proc_entry;
+#endif
+static struct proc_dir_entry *lists_dir;
+static struct proc_dir_entry *control_proc_entry;
+
+#ifdef RCU_MODE
+/* List head, sort and cleanup replace it as a whole */
+typedef struct {
+    struct list_head head;
+    struct list_head retired;   // link in the roots waiting to be freed
+}list_root_t;
+#endif
+
+#ifdef LIST_MODE
+static unsigned int index_bits = 14;
+module_param(index_bits, uint, 0444);
+MODULE_PARM_DESC(index_bits, "log2 of the number of buckets of the value index");
+#endif
+
+#ifdef STRING_MODE
+static bool intern = true;
+module_param(intern, bool, 0444);
+MODULE_PARM_DESC(intern, "Store equal strings once, shared by all the nodes holding them");
+
+/* Every string, by hash. intern_lock protects the table, the refs and intern_bytes */
+static struct hlist_head intern_table[1 << INTERN_BITS];
+static DEFINE_SPINLOCK(intern_lock);
+static unsigned long intern_bytes;
+#endif
+
+static unsigned int render_max = 16 << 20;
+module_param(render_max, uint, 0644);
+MODULE_PARM_DESC(render_max, "Maximum size in bytes of the cached text of the list, 0 disables it");
+
+/*
+ * A list with everything of its own: storage, lock, allocators and caches.
+ * /proc/modlist is default_list, the ones in /proc/modlists are created and
+ * deleted by name through its control file.
+ */
+typedef struct modlist_s {
+#if defined(RCU_MODE)
+    struct mutex wmtx;
+#elif !defined(TEST_NO_LOCK)
+    rwlock_t sp;
+#endif
+    u64 write_locked_at;        // when the write lock was taken, only its holder uses it
+
+#if defined(ARRAY_MODE)
+    /* Packed values, the first array_len of the array_cap slots are in use */
+    int *array;
+    size_t array_len, array_cap;
+    size_t array_sorted;        // the first array_sorted values are in order
+#elif defined(RBTREE_MODE)
+    struct rb_root tree;        // tree of the distinct values
+#elif defined(RCU_MODE)
+    list_root_t __rcu *root;
+#else
+    struct list_head list;
+#endif
+
+#ifndef ARRAY_MODE
+    nodepool_t *node_pool;      // allocator of the nodes
+    unsigned long nr_items;     // changed with the write lock held (ARRAY_MODE has array_len)
+#endif
+
+#ifdef LIST_MODE
+    /* Value index buckets, and the allocator of its entries */
+    struct hlist_head *value_index;
+    nodepool_t *entry_pool;
+
+    struct list_head *sorted_tail;  // last node of the sorted prefix, the head if it is empty
+    struct rb_root value_order;     // the index entries in order of their value, for min and max
+#ifndef STRING_MODE
+    struct list_head radix_buckets[1 << RADIX_BITS];
+#endif
+#endif
+
+#ifdef STAGED_ADD
+    struct llist_head staged;   // nodes added without the lock, the last one first
+#endif
+
+    /* Aggregates for the queries, kept by every change (write lock held) */
+#ifndef STRING_MODE
+    s64 sum;
+#endif
+#ifdef ARRAY_MODE
+    int min, max;               // only meaningful when extremes is EXTREMES_OK
+    int extremes;
+#endif
+
+    /*
+     * Incremented on every list modification. In RCU_MODE it is bumped once the
+     * change is visible and before anything unlinked is freed, so a reader that
+     * sees an unchanged value can trust the node it saved.
+     */
+    unsigned long list_gen;
+
+    /* Last rendered text. render_lock protects the pointer, len, gen and refs */
+    struct render_s *render_cache;
+    spinlock_t render_lock;
+    unsigned int render_chars;      // chars per item of the last render, 0 before the first (render_lock)
+    unsigned long render_skip_gen;  // list_gen whose text was larger than render_max (render_lock)
+    unsigned int render_skip_max;   // render_max it was larger than, 0 if none
+
+#ifndef STRING_MODE
+    struct modlist_snap_live *snap_live;    // page mapped in front of every snapshot
+    struct snap_s *snap_cache;              // last snapshot (snap_lock)
+#endif
+
+    char name[NAME_LENGHT];     // empty for default_list
+    struct list_head links;     // link in named_lists
+}modlist_t;
+
+/* State of min and max in ARRAY_MODE: empty list or up to date */
+enum { EXTREMES_NONE, EXTREMES_OK };
+
+/* named_lock serializes the changes of named_lists and the walks over it */
+static modlist_t *default_list;
+static LIST_HEAD(named_lists);
+static DEFINE_MUTEX(named_lock);
+
+#if defined(RCU_MODE)
+ #define ml_list(ml) (rcu_dereference_check((ml)->root, lockdep_is_held(&(ml)->wmtx))->head)
+#elif defined(LIST_MODE)
+ #define ml_list(ml) ((ml)->list)
+#endif
+
+#ifndef ARRAY_MODE
+ #define list_items(ml) READ_ONCE((ml)->nr_items)
+#else
+ #define list_items(ml) ((unsigned long)READ_ONCE((ml)->array_len))
+#endif
+
+/* The write lock, timing the wait for it and how long it is held */
+static inline void list_write_lock(modlist_t *ml) {
+    u64 start = ktime_get_ns();
+
+    __list_write_lock(ml);
+    ml->write_locked_at = ktime_get_ns();
+    stats_record(STAT_LOCK_WAIT, ml->write_locked_at - start);
+}
+
+static inline void list_write_unlock(modlist_t *ml) {
+    u64 held = ktime_get_ns() - ml->write_locked_at;
+
+    __list_write_unlock(ml);
+    stats_record(STAT_LOCK_HOLD, held);
+}
+
+#ifdef RBTREE_MODE
+/* Tree nodes, one for every distinct value */
+typedef struct {
+#ifdef STRING_MODE
+    mstring_t *data;
+#else
+    int data;
+#endif
+    unsigned long count;        // occurrences of data, never 0
+    struct rb_node node;
+}list_item_t;
+#elif defined(LIST_MODE)
+/* List nodes */
+typedef struct {
+#ifdef STRING_MODE
+    mstring_t *data;
+#else
+    int data;
+#endif
+#ifdef STAGED_ADD
+    union {
+        struct list_head links;
+        struct llist_node stage;    // link in staged, until it is merged
+    };
+#else
+    struct list_head links;
+#endif
+    struct hlist_node vlink;    // link in the index entry of its value
+#ifdef RCU_MODE
+    struct rcu_head rcu;
+    struct modlist_s *ml;       // list it is released from, for free_item_rcu
+#endif
+}list_item_t;
+
+/* Index entry, one for every distinct value in the list */
+typedef struct {
+    struct hlist_node hnode;    // bucket link
+    value_t value;              // the one of its first node, the string is held by the nodes
+    struct hlist_head nodes;    // nodes holding the value, never empty
+    unsigned long count;        // nodes in it
+    struct rb_node order;       // link in value_order
+}index_entry_t;
+#endif
+
+/*
+ * Per open file state. The reader part is saved between read calls, the
+ * writer part keeps a line split between two write calls, and the answers
+ * of the queries for the next read (the VFS serializes the reads and writes
+ * on the same open file).
+ */
+typedef struct {
+    struct modlist_s *ml;       // list of the /proc entry
+#ifdef RBTREE_MODE
+    struct rb_node *cursor;     // node of the next item to print (NULL at the end)
+    unsigned long rep;          // occurrence of cursor to print
+#elif defined(LIST_MODE)
+    struct list_head *head;     // list cursor belongs to
+    struct list_head *cursor;   // next node to print (NULL at the end)
+#endif
+    loff_t pos;                 // seq_file position of cursor
+    unsigned long gen;          // list_gen when cursor was saved
+    struct render_s *render;    // text being read (NULL: read through seq_file)
+    size_t render_len;          // chars of it this file reads
+    char pending[LINE_LENGHT];  // start of an unfinished line
+    int pending_len;
+    char answer[ANSWER_LENGHT]; // answers of the queries, until a read returns them
+    int answer_len;
+    int answer_pos;             // chars of them already read
+}modlist_file_t;
+
+/* Parsed command, the node of an add is allocated before taking the lock */
+enum { CMD_NONE, CMD_ADD, CMD_REMOVE, CMD_CLEANUP, CMD_SORT,
+       CMD_COUNT, CMD_CONTAINS, CMD_OCCURRENCES, CMD_MIN, CMD_MAX, CMD_SUM };
+
+static const int cmd_stat[] = {
+    [CMD_ADD] = STAT_ADD,
+    [CMD_REMOVE] = STAT_REMOVE,
+    [CMD_CLEANUP] = STAT_CLEANUP,
+    [CMD_SORT] = STAT_SORT,
+    [CMD_COUNT ... CMD_SUM] = STAT_QUERY,
+};
+
+typedef struct {
+    int type;
+#ifndef ARRAY_MODE
+    list_item_t *item;          // CMD_ADD: node to link
+#endif
+#ifdef STRING_MODE
+    mstring_t *value;           // CMD_ADD (given to the node), CMD_REMOVE and lookups
+#else
+    int value;
+#endif
+    size_t end;                 // modlist_write: chars of the write up to the end of its line
+}modlist_cmd_t;
+
+
+#ifdef LIST_MODE
+int botupcmp(void *priv, struct list_head *a, struct list_head *b) {
+    list_item_t *entry_a, *entry_b;
+
+    entry_a = list_entry(a, list_item_t, links);
+    entry_b = list_entry(b, list_item_t, links);
+
+    // not a subtraction, it overflows for values far apart
+    return compare_value(entry_a->data, entry_b->data);
+}
+#endif
+
+
+#ifdef STRING_MODE
+/*****************************************************************************
+ *
+ * Strings. They are taken when a command is parsed, before the write lock,
+ * and the last put can come from an RCU callback, so intern_lock is _bh.
+ *
+ ****************************************************************************/
+static u32 mstring_hash(const char *text, u32 *len) {
+    const char *c;
+    u32 hash = 0;
+
+    // casefolded, values equal for strcasecmp must have the same hash
+    for (c = text; *c; c++)
+        hash = (hash + tolower(*c)) * 31;
+    *len = c - text;
+
+    return hash;
+}
+
+/* Takes a reference to the interned copy of text, if there is one (intern_lock held) */
+static mstring_t *intern_lookup(struct hlist_head *bucket, const char *text, u32 hash, u32 len) {
+    mstring_t *str;
+
+    hlist_for_each_entry(str, bucket, hnode) {
+        if (str->hash == hash && str->len == len && !memcmp(str->text, text, len)) {
+            str->refs++;
+            return str;
+        }
+    }
+
+    return NULL;
+}
+
+/* Returns a string holding text, shared with the equal ones if intern is set */
+static mstring_t *mstring_get(const char *text) {
+    struct hlist_head *bucket;
+    mstring_t *str, *found;
+    u32 hash, len;
+
+    hash = mstring_hash(text, &len);
+    bucket = &intern_table[hash_32(hash, INTERN_BITS)];
+
+    if (intern) {
+        spin_lock_bh(&intern_lock);
+        found = intern_lookup(bucket, text, hash, len);
+        spin_unlock_bh(&intern_lock);
+        if (found != NULL)
+            return found;
+    }
+
+    str = kmalloc(sizeof(mstring_t) + len + 1, GFP_KERNEL);
+    if (str == NULL)
+        return NULL;
+    str->refs = 1;
+    str->hash = hash;
+    str->len = len;
+    memcpy(str->text, text, len + 1);
+
+    spin_lock_bh(&intern_lock);
+    // another writer may have added the same text meanwhile
+    found = intern ? intern_lookup(bucket, text, hash, len) : NULL;
+    if (found == NULL) {
+        hlist_add_head(&str->hnode, bucket);
+        intern_bytes += sizeof(mstring_t) + len + 1;
+    }
+    spin_unlock_bh(&intern_lock);
+
+    if (found != NULL) {
+        kfree(str);
+        return found;
+    }
+
+    return str;
+}
+
+#ifdef RCU_MODE
+/* One more holder of str, for the sorted copy of the list */
+static mstring_t *mstring_dup(mstring_t *str) {
+    spin_lock_bh(&intern_lock);
+    str->refs++;
+    spin_unlock_bh(&intern_lock);
+
+    return str;
+}
+#endif
+
+static void mstring_put(mstring_t *str) {
+    int last;
+
+    if (str == NULL)
+        return;
+
+    spin_lock_bh(&intern_lock);
+    last = (--str->refs == 0);
+    if (last) {
+        hlist_del(&str->hnode);
+        intern_bytes -= sizeof(mstring_t) + str->len + 1;
+    }
+    spin_unlock_bh(&intern_lock);
+
+    if (last)
+        kfree(str);
+}
+#endif
+
+
+/* Publishes a list modification to the readers (write lock held) */
+static inline void list_modified(modlist_t *ml) {
+    smp_wmb();
+    WRITE_ONCE(ml->list_gen, ml->list_gen + 1);
+#ifndef STRING_MODE
+    WRITE_ONCE(ml->snap_live->gen, ml->list_gen);
+#endif
+}
+
+
+/* Query aggregates, all of them with the write lock held */
+#ifndef STRING_MODE
+ #define sum_add(ml, value, n) ((ml)->sum += (s64)(value) * (n))
+#else
+ #define sum_add(ml, value, n)
+#endif
+
+#ifdef ARRAY_MODE
+/* Takes value into min and max. The removes find them again in their pass */
+static inline void extremes_add(modlist_t *ml, int value) {
+    if (ml->extremes == EXTREMES_NONE) {
+        ml->min = ml->max = value;
+        ml->extremes = EXTREMES_OK;
+    } else {
+        ml->min = min(ml->min, value);
+        ml->max = max(ml->max, value);
+    }
+}
+#endif
+
+/* The list is empty again */
+static inline void aggregates_clear(modlist_t *ml) {
+#ifndef STRING_MODE
+    ml->sum = 0;
+#endif
+#ifdef ARRAY_MODE
+    ml->extremes = EXTREMES_NONE;
+#endif
+}
+
+
+/* Text of the whole list, shared by every open file reading the same list_gen */
+typedef struct render_s {
+    unsigned long gen;          // list_gen the text belongs to
+    size_t len;                 // chars in use
+    size_t size;                // chars allocated
+    int refs;                   // render_cache and the open files using it
+    char text[];
+}render_t;
+
+
+#ifndef RBTREE_MODE
+/*
+ * Appends value to the cached text if it is up to date, so an add does not
+ * discard it. Called with the write lock held, before list_modified. Open
+ * files only read up to the length they saw, the chars after it are free.
+ */
+static void render_append(modlist_t *ml, value_t value) {
+    render_t *r;
+    int n;
+
+    spin_lock(&ml->render_lock);
+    r = ml->render_cache;
+    if (r != NULL && r->gen == ml->list_gen) {
+        n = snprintf(r->text + r->len, r->size - r->len, DATA_PRINT_FORMAT"\n", DATA_PRINT_ARG(value));
+        if (r->len + n < r->size) {
+            r->len += n;
+            r->gen = ml->list_gen + 1;
+        }
+    }
+    spin_unlock(&ml->render_lock);
+}
+#endif
+
+
+#ifndef ARRAY_MODE
+/* Returns a node, and its reference to the string, to their allocators */
+static void free_item(modlist_t *ml, list_item_t *item) {
+#ifdef STRING_MODE
+    mstring_put(item->data);
+#endif
+    free_nodepool_t(ml->node_pool, item);
+}
+#endif
+
+#ifdef RCU_MODE
+static void free_item_rcu(struct rcu_head *head) {
+    list_item_t *item = container_of(head, list_item_t, rcu);
+
+    free_item(item->ml, item);
+}
+#endif
+
+#ifndef ARRAY_MODE
+/* Releases an unlinked node, once no reader can be looking at it */
+static void release_item(modlist_t *ml, list_item_t *item) {
+#ifdef RCU_MODE
+    item->ml = ml;
+    call_rcu(&item->rcu, free_item_rcu);
+#else
+    free_item(ml, item);
+#endif
+}
+#endif
+
+#if (defined(RBTREE_MODE) && !defined(STRING_MODE)) || defined(ARRAY_MODE)
+/* Comparison for sort() */
+static int cmp_int(const void *a, const void *b) {
+    int x = *(const int *)a, y = *(const int *)b;
+
+    return (x > y) - (x < y);
+}
+#endif
+
+
+#ifdef LIST_MODE
+/*****************************************************************************
+ *
+ * Sorted prefix. sort only sorts the nodes after sorted_tail, and merges
+ * them with the prefix in one pass. All of it runs with the write lock held.
+ *
+ ****************************************************************************/
+
+/* Extends the prefix over the nodes appended in order. Every node is passed once */
+static void sorted_extend(modlist_t *ml) {
+    struct list_head *next;
+
+    for (next = ml->sorted_tail->next; next != &ml_list(ml); next = next->next) {
+        if (ml->sorted_tail != &ml_list(ml) && botupcmp(NULL, ml->sorted_tail, next) > 0)
+            break;
+        ml->sorted_tail = next;
+    }
+}
+
+/* Called before unlinking item, the prefix stays sorted without it */
+static inline void sorted_unlink(modlist_t *ml, list_item_t *item) {
+    if (ml->sorted_tail == &(item->links))
+        ml->sorted_tail = item->links.prev;
+}
+
+#ifndef STRING_MODE
+/* Radix key of value, the sign bit flipped so negatives go first */
+static inline u32 radix_key(int value) {
+    return (u32)value ^ 0x80000000U;
+}
+
+/*
+ * LSD radix sort of the nodes of head, relinking them through the buckets
+ * one digit at a time. Digits where every value is the same are skipped.
+ * Equal values keep their order.
+ */
+static void radix_sort(modlist_t *ml, struct list_head *head) {
+    struct list_head *pos, *temp;
+    u32 key, all_or = 0, all_and = ~0U;
+    unsigned long nr = 0;
+    unsigned int shift, b;
+
+    list_for_each(pos, head) {
+        key = radix_key(list_entry(pos, list_item_t, links)->data);
+        all_or |= key;
+        all_and &= key;
+        nr++;
+    }
+
+    if (nr < RADIX_MIN) {
+        list_sort(NULL, head, botupcmp);
+        return;
+    }
+
+    for (b = 0; b < (1 << RADIX_BITS); b++)
+        INIT_LIST_HEAD(&ml->radix_buckets[b]);
+
+    for (shift = 0; shift < 32; shift += RADIX_BITS) {
+        if ((((all_or ^ all_and) >> shift) & ((1 << RADIX_BITS) - 1)) == 0)
+            continue;
+
+        list_for_each_safe(pos, temp, head) {
+            key = radix_key(list_entry(pos, list_item_t, links)->data);
+            list_move_tail(pos, &ml->radix_buckets[(key >> shift) & ((1 << RADIX_BITS) - 1)]);
+        }
+        for (b = 0; b < (1 << RADIX_BITS); b++)
+            list_splice_tail_init(&ml->radix_buckets[b], head);
+    }
+}
+#endif
+
+/*
+ * Sorts the nodes of the list head after last, and merges the ones up to
+ * last (already sorted) into them. Equal values keep their order.
+ */
+static void merge_sort_tail(modlist_t *ml, struct list_head *head, struct list_head *last) {
+    LIST_HEAD(prefix);
+    struct list_head *pos, *temp, *at;
+
+    list_cut_position(&prefix, head, last);
+#ifdef STRING_MODE
+    list_sort(NULL, head, botupcmp);
+#else
+    radix_sort(ml, head);
+#endif
+
+    at = head->next;
+    list_for_each_safe(pos, temp, &prefix) {
+        while (at != head && botupcmp(NULL, at, pos) < 0)
+            at = at->next;
+        list_move_tail(pos, at);
+    }
+}
+
+
+/*****************************************************************************
+ *
+ * Value index. Only the writers use it, always with the write lock held.
+ *
+ ****************************************************************************/
+#ifdef STRING_MODE
+static struct hlist_head *index_bucket(modlist_t *ml, value_t value) {
+    return &ml->value_index[hash_32(value->hash, index_bits)];
+}
+#else
+static struct hlist_head *index_bucket(modlist_t *ml, int value) {
+    return &ml->value_index[hash_32(value, index_bits)];
+}
+#endif
+
+/* Links an entry that just got its first node in value_order */
+static void order_insert(modlist_t *ml, index_entry_t *entry) {
+    struct rb_node **link = &ml->value_order.rb_node, *parent = NULL;
+
+    while (*link) {
+        parent = *link;
+        if (compare_value(entry->value, rb_entry(parent, index_entry_t, order)->value) < 0)
+            link = &parent->rb_left;
+        else
+            link = &parent->rb_right;
+    }
+    rb_link_node(&entry->order, parent, link);
+    rb_insert_color(&entry->order, &ml->value_order);
+}
+
+static index_entry_t *index_lookup(struct hlist_head *bucket, value_t value) {
+    index_entry_t *entry;
+
+    hlist_for_each_entry(entry, bucket, hnode) {
+        if (same_value(entry->value, value))
+            return entry;
+    }
+
+    return NULL;
+}
+
+/*
+ * Indexes item, creating the entry of its value if it is new. It does not
+ * sleep, the entry is allocated with the write lock held.
+ */
+static int index_add(modlist_t *ml, list_item_t *item) {
+    struct hlist_head *bucket = index_bucket(ml, item->data);
+    index_entry_t *entry = index_lookup(bucket, item->data);
+
+    if (entry == NULL) {
+        entry = alloc_atomic_nodepool_t(ml->entry_pool);
+        if (entry == NULL)
+            return -ENOMEM;
+        INIT_HLIST_HEAD(&entry->nodes);
+        entry->value = item->data;
+        entry->count = 0;
+        hlist_add_head(&entry->hnode, bucket);
+    }
+    hlist_add_head(&item->vlink, &entry->nodes);
+    if (entry->count++ == 0)
+        order_insert(ml, entry);
+    ml->nr_items++;
+    sum_add(ml, item->data, 1);
+
+    return 0;
+}
+
+/* Unlinks and releases every node holding value */
+static void index_remove(modlist_t *ml, value_t value) {
+    index_entry_t *entry;
+    list_item_t *pos;
+    struct hlist_node *temp;
+    unsigned long removed = 0;
+
+    entry = index_lookup(index_bucket(ml, value), value);
+    if (entry == NULL)
+        return;
+
+    // before the nodes, and the strings they hold, are released
+    sum_add(ml, value, -(s64)entry->count);
+    rb_erase(&entry->order, &ml->value_order);
+    hlist_del(&entry->hnode);
+
+    hlist_for_each_entry_safe(pos, temp, &entry->nodes, vlink) {
+        removed++;
+        sorted_unlink(ml, pos);
+        item_del(&(pos->links));
+        ml->nr_items--;
+        list_modified(ml);
+        release_item(ml, pos);
+    }
+    trace_modlist_remove(DATA_PRINT_ARG(value), removed);
+
+    free_nodepool_t(ml->entry_pool, entry);
+}
+
+/* Drops every entry, the nodes are released by the caller */
+static void index_clear(modlist_t *ml) {
+    index_entry_t *entry;
+    struct hlist_node *temp;
+    unsigned int i;
+
+    ml->nr_items = 0;
+    aggregates_clear(ml);
+    ml->value_order = RB_ROOT;
+
+    for (i = 0; i < (1U << index_bits); i++) {
+        hlist_for_each_entry_safe(entry, temp, &ml->value_index[i], hnode) {
+            free_nodepool_t(ml->entry_pool, entry);
+        }
+        INIT_HLIST_HEAD(&ml->value_index[i]);
+    }
+}
+#endif
+
+
+#ifdef STAGED_ADD
+/* Links the staged nodes at the end of the list (write lock held) */
+static void stage_merge(modlist_t *ml) {
+    struct llist_node *first;
+    list_item_t *pos, *temp;
+
+    first = llist_del_all(&ml->staged);
+    if (first == NULL)
+        return;
+
+    // back to the order they were pushed in, which keeps the one of every writer
+    first = llist_reverse_order(first);
+
+    llist_for_each_entry_safe(pos, temp, first, stage) {
+        if (index_add(ml, pos)) {
+            printk(KERN_INFO "Modlist: Can't add item to list\n");
+            free_item(ml, pos);
+            continue;
+        }
+        item_add_tail(&(pos->links), &ml_list(ml));
+        render_append(ml, pos->data);
+        list_modified(ml);
+    }
+    sorted_extend(ml);
+}
+
+/* Merges the staged nodes, if there is any, before a read */
+static void stage_flush(modlist_t *ml) {
+    if (llist_empty(&ml->staged))
+        return;
+
+    list_write_lock(ml);
+    stage_merge(ml);
+    list_write_unlock(ml);
+}
+#else
+ #define stage_merge(ml)
+ #define stage_flush(ml)
+#endif
+
+
+#ifdef RBTREE_MODE
+/*****************************************************************************
+ *
+ * Sorted tree. The writers change it with the write lock held, the readers
+ * walk it with the read lock held.
+ *
+ ****************************************************************************/
+
+/*
+ * Returns the node of value, or NULL and where it should be linked in
+ * *link and *parent.
+ */
+static list_item_t *tree_find(modlist_t *ml, value_t value, struct rb_node ***link, struct rb_node **parent) {
+    struct rb_node **new = &ml->tree.rb_node;
+    list_item_t *item;
+    int cmp;
+
+    *parent = NULL;
+    while (*new) {
+        item = rb_entry(*new, list_item_t, node);
+        cmp = compare_value(value, item->data);
+        if (cmp == 0)
+            return item;
+        *parent = *new;
+        new = (cmp < 0) ? &(*new)->rb_left : &(*new)->rb_right;
+    }
+    *link = new;
+
+    return NULL;
+}
+
+static void tree_link(modlist_t *ml, list_item_t *item, unsigned long count, struct rb_node **link, struct rb_node *parent) {
+    item->count = count;
+    rb_link_node(&item->node, parent, link);
+    rb_insert_color(&item->node, &ml->tree);
+}
+
+/* Counts one more item->data. item is released if the value was already there */
+static void tree_add(modlist_t *ml, list_item_t *item) {
+    struct rb_node **link, *parent;
+    list_item_t *found;
+
+    sum_add(ml, item->data, 1);
+    found = tree_find(ml, item->data, &link, &parent);
+    if (found != NULL) {
+        found->count++;
+        release_item(ml, item);
+    } else {
+        tree_link(ml, item, 1, link, parent);
+    }
+    ml->nr_items++;
+    list_modified(ml);
+}
+
+/* Drops every occurrence of value */
+static void tree_remove(modlist_t *ml, value_t value) {
+    struct rb_node **link, *parent;
+    list_item_t *item;
+
+    item = tree_find(ml, value, &link, &parent);
+    if (item == NULL)
+        return;
+
+    trace_modlist_remove(DATA_PRINT_ARG(value), item->count);
+    rb_erase(&item->node, &ml->tree);
+    ml->nr_items -= item->count;
+    sum_add(ml, value, -(s64)item->count);
+    list_modified(ml);
+    release_item(ml, item);
+}
+
+static void tree_clear(modlist_t *ml) {
+    list_item_t *pos, *temp;
+
+    rbtree_postorder_for_each_entry_safe(pos, temp, &ml->tree, node) {
+        release_item(ml, pos);
+    }
+    ml->tree = RB_ROOT;
+    ml->nr_items = 0;
+    aggregates_clear(ml);
+    list_modified(ml);
+}
+#endif
+
+
+#ifdef ARRAY_MODE
+/*****************************************************************************
+ *
+ * Packed array. The writers change it with the write lock held, the readers
+ * index it with the read lock held.
+ *
+ ****************************************************************************/
+
+/*
+ * Takes the write lock with room in the array for extra more values. The
+ * array can't be reallocated with the lock held, so it is done before and
+ * checked again. The buffer to vfree once the lock is released is left in
+ * *old.
+ */
+static int array_write_lock(modlist_t *ml, size_t extra, int **old) {
+    int *new;
+    size_t cap;
+
+    *old = NULL;
+    list_write_lock(ml);
+
+    while (ml->array_len + extra > ml->array_cap) {
+        cap = max_t(size_t, ml->array_cap * 2, ml->array_len + extra);
+        cap = max_t(size_t, cap, ARRAY_MIN_CAP);
+        list_write_unlock(ml);
+
+        vfree(*old);
+        *old = NULL;
+        new = vmalloc(cap * sizeof(int));
+        if (new == NULL)
+            return -ENOMEM;
+
+        list_write_lock(ml);
+        if (cap > ml->array_cap) {
+            memcpy(new, ml->array, ml->array_len * sizeof(int));
+            *old = ml->array;
+            ml->array = new;
+            ml->array_cap = cap;
+        } else {
+            // another writer grew it meanwhile
+            *old = new;
+        }
+    }
+
+    return 0;
+}
+
+/* Drops every occurrence of value, keeping the order of the rest */
+static void array_remove(modlist_t *ml, int value) {
+    size_t i, j, sorted;
+    int v, keep, lo = INT_MAX, hi = INT_MIN;
+
+    // no branches, every value is copied and only the kept ones are counted
+    for (i = 0, j = 0, sorted = 0; i < ml->array_len; i++) {
+        v = ml->array[i];
+        ml->array[j] = v;
+        keep = (v != value);
+        j += keep;
+        sorted += keep & (i < ml->array_sorted);
+        lo = (keep && v < lo) ? v : lo;
+        hi = (keep && v > hi) ? v : hi;
+    }
+
+    if (j != ml->array_len) {
+        trace_modlist_remove(DATA_PRINT_ARG(value), ml->array_len - j);
+        sum_add(ml, value, -(s64)(ml->array_len - j));
+        // the pass went over all the values left, min and max are theirs
+        ml->extremes = EXTREMES_NONE;
+        if (j > 0) {
+            extremes_add(ml, lo);
+            extremes_add(ml, hi);
+        }
+        ml->array_len = j;
+        ml->array_sorted = sorted;
+        list_modified(ml);
+    }
+}
+
+/* Drops every occurrence of the nr values of set, that must be sorted */
+static void array_remove_set(modlist_t *ml, const int *set, size_t nr) {
+    size_t i, j, sorted;
+    s64 removed = 0;
+    int v, keep, lo = INT_MAX, hi = INT_MIN;
+
+    for (i = 0, j = 0, sorted = 0; i < ml->array_len; i++) {
+        v = ml->array[i];
+        ml->array[j] = v;
+        keep = (bsearch(&v, set, nr, sizeof(int), cmp_int) == NULL);
+        j += keep;
+        sorted += keep & (i < ml->array_sorted);
+        removed += (s64)v * !keep;
+        lo = (keep && v < lo) ? v : lo;
+        hi = (keep && v > hi) ? v : hi;
+    }
+
+    if (j != ml->array_len) {
+        ml->sum -= removed;
+        ml->extremes = EXTREMES_NONE;
+        if (j > 0) {
+            extremes_add(ml, lo);
+            extremes_add(ml, hi);
+        }
+        ml->array_len = j;
+        ml->array_sorted = sorted;
+        list_modified(ml);
+    }
+}
+
+/* Extends the sorted prefix over the values appended in order */
+static void array_sorted_extend(modlist_t *ml) {
+    while (ml->array_sorted < ml->array_len &&
+           (ml->array_sorted == 0 || ml->array[ml->array_sorted - 1] <= ml->array[ml->array_sorted]))
+        ml->array_sorted++;
+}
+
+/*
+ * Sorts the values after the sorted prefix, and merges both from the end
+ * with the tail copied to the free slots. Without room for it, the whole
+ * array is sorted.
+ */
+static void array_sort(modlist_t *ml) {
+    size_t tail = ml->array_len - ml->array_sorted;
+    size_t i, j, k;
+    int *spare;
+
+    if (tail == 0)
+        return;
+
+    if (ml->array_cap - ml->array_len < tail) {
+        sort(ml->array, ml->array_len, sizeof(int), cmp_int, NULL);
+    } else {
+        spare = ml->array + ml->array_len;
+        memcpy(spare, ml->array + ml->array_sorted, tail * sizeof(int));
+        sort(spare, tail, sizeof(int), cmp_int, NULL);
+
+        // k == i + j, the prefix values not moved yet are never overwritten
+        for (i = ml->array_sorted, j = tail, k = ml->array_len; j > 0; ) {
+            if (i > 0 && ml->array[i - 1] > spare[j - 1])
+                ml->array[--k] = ml->array[--i];
+            else
+                ml->array[--k] = spare[--j];
+        }
+    }
+
+    ml->array_sorted = ml->array_len;
+    list_modified(ml);
+}
+
+/* Frees the array if it is still empty, as cleanup does with the node pools */
+static void array_release_empty(modlist_t *ml) {
+    int *old = NULL;
+
+    list_write_lock(ml);
+    if (ml->array_len == 0) {
+        old = ml->array;
+        ml->array = NULL;
+        ml->array_cap = 0;
+    }
+    list_write_unlock(ml);
+
+    vfree(old);
+}
+#endif
+
+
+#ifdef RCU_MODE
+static list_root_t *create_root(void) {
+    list_root_t *root = kmalloc(sizeof(list_root_t), GFP_KERNEL);
+
+    if (root != NULL)
+        INIT_LIST_HEAD(&root->head);
+
+    return root;
+}
+
+/* Publishes new_root (write lock held) and returns the replaced one. Its sorted prefix starts empty */
+static list_root_t *swap_root(modlist_t *ml, list_root_t *new_root) {
+    list_root_t *old_root;
+
+    old_root = rcu_dereference_protected(ml->root, lockdep_is_held(&ml->wmtx));
+    rcu_assign_pointer(ml->root, new_root);
+    ml->sorted_tail = &new_root->head;
+    list_modified(ml);
+
+    return old_root;
+}
+
+#ifndef STRING_MODE
+/* Links a private list at the end of the published one, all at once */
+static void item_splice_tail(struct list_head *list, struct list_head *head) {
+    struct list_head *first = list->next;
+    struct list_head *last = list->prev;
+    struct list_head *at = head->prev;
+
+    if (list_empty(list))
+        return;
+
+    last->next = head;
+    first->prev = at;
+    head->prev = last;
+    rcu_assign_pointer(list_next_rcu(at), first);
+}
+#endif
+
+/* Frees replaced roots and their nodes. It waits for the readers, call it unlocked */
+static void release_roots(modlist_t *ml, struct list_head *retired) {
+    list_root_t *root, *next_root;
+    list_item_t *pos, *temp;
+
+    if (list_empty(retired))
+        return;
+
+    synchronize_rcu();
+
+    list_for_each_entry_safe(root, next_root, retired, retired) {
+        list_for_each_entry_safe(pos, temp, &root->head, links) {
+            free_item(ml, pos);
+        }
+        kfree(root);
+    }
+}
+
+/* Returns a sorted copy of the list, indexed in place of the original (write lock held) */
+static list_root_t *sorted_copy(modlist_t *ml) {
+    list_root_t *root;
+    list_item_t *pos, *temp;
+    struct list_head *last;
+
+    root = create_root();
+    if (root == NULL)
+        return NULL;
+    last = &root->head;
+
+    list_for_each_entry(pos, &ml_list(ml), links) {
+        temp = alloc_nodepool_t(ml->node_pool);
+        if (temp == NULL) {
+            list_for_each_entry_safe(pos, temp, &root->head, links) {
+                free_item(ml, pos);
+            }
+            kfree(root);
+            return NULL;
+        }
+#ifdef STRING_MODE
+        temp->data = mstring_dup(pos->data);
+#else
+        temp->data = pos->data;
+#endif
+        list_add_tail(&(temp->links), &root->head);
+        if (&(pos->links) == ml->sorted_tail)
+            last = &(temp->links);
+    }
+
+    // every copy takes the place of its original in the index
+    temp = list_first_entry(&root->head, list_item_t, links);
+    list_for_each_entry(pos, &ml_list(ml), links) {
+        hlist_replace_rcu(&pos->vlink, &temp->vlink);
+        temp = list_next_entry(temp, links);
+    }
+
+    merge_sort_tail(ml, &root->head, last);
+
+    return root;
+}
+#endif
+
+
+/*
+ * seq_file iterator. Every read call formats a page of items under the read
+ * lock, and the copy to user space is done by seq_read once it is released.
+ * The position where the last call stopped is saved, so the next one goes on
+ * from there instead of walking the list from its head again, unless the list
+ * has been modified in between.
+ */
+#if defined(ARRAY_MODE)
+/* *pos is the index of the value, there is nothing to save between calls */
+static void *modlist_seq_start(struct seq_file *m, loff_t *pos) {
+    modlist_t *ml = ((modlist_file_t *)m->private)->ml;
+
+    list_read_lock(ml);
+
+    return (*pos < ml->array_len) ? &ml->array[*pos] : NULL;
+}
+
+static void *modlist_seq_next(struct seq_file *m, void *v, loff_t *pos) {
+    modlist_t *ml = ((modlist_file_t *)m->private)->ml;
+
+    (*pos)++;
+
+    return (*pos < ml->array_len) ? &ml->array[*pos] : NULL;
+}
+#elif defined(RBTREE_MODE)
+/* Every occurrence of a value is an item of its own, *pos counts them all */
+static void *modlist_seq_start(struct seq_file *m, loff_t *pos) {
+    modlist_file_t *state = m->private;
+    modlist_t *ml = state->ml;
+    struct rb_node *node;
+    list_item_t *item;
+    unsigned long gen;
+    loff_t left = *pos;
+
+    list_read_lock(ml);
+
+    gen = READ_ONCE(ml->list_gen);
+    smp_rmb();
+
+    if (state->pos == *pos && state->gen == gen)
+        return state->cursor;
+
+    // whole nodes are skipped, there is no need to count their items one by one
+    for (node = rb_first(&ml->tree); node != NULL; node = rb_next(node)) {
+        item = rb_entry(node, list_item_t, node);
+        if (left < item->count)
+            break;
+        left -= item->count;
+    }
+
+    state->cursor = node;
+    state->rep = left;
+    state->pos = *pos;
+    state->gen = gen;
+
+    return state->cursor;
+}
+
+static void *modlist_seq_next(struct seq_file *m, void *v, loff_t *pos) {
+    modlist_file_t *state = m->private;
+    list_item_t *item = rb_entry((struct rb_node *)v, list_item_t, node);
+
+    (*pos)++;
+    if (++state->rep == item->count) {
+        state->cursor = rb_next(v);
+        state->rep = 0;
+    }
+    state->pos = *pos;
+
+    return state->cursor;
+}
+#else
+static void *modlist_seq_start(struct seq_file *m, loff_t *pos) {
+    modlist_file_t *state = m->private;
+    modlist_t *ml = state->ml;
+    struct list_head *node;
+    unsigned long gen;
+    loff_t i;
+
+    // the adds staged so far are read too
+    stage_flush(ml);
+
+    list_read_lock(ml);
+
+    gen = READ_ONCE(ml->list_gen);
+    smp_rmb();
+
+    if (state->pos == *pos && state->gen == gen)
+        return state->cursor;
+
+    state->head = &ml_list(ml);
+    node = item_next(state->head);
+    for (i = 0; i < *pos && node != state->head; i++)
+        node = item_next(node);
+
+    state->cursor = (node != state->head) ? node : NULL;
+    state->pos = *pos;
+    state->gen = gen;
+
+    return state->cursor;
+}
+
+static void *modlist_seq_next(struct seq_file *m, void *v, loff_t *pos) {
+    modlist_file_t *state = m->private;
+    struct list_head *node = item_next((struct list_head *)v);
+
+    (*pos)++;
+    state->cursor = (node != state->head) ? node : NULL;
+    state->pos = *pos;
+
+    return state->cursor;
+}
+#endif
+
+static void modlist_seq_stop(struct seq_file *m, void *v) {
+    list_read_unlock(((modlist_file_t *)m->private)->ml);
+}
+
+#ifdef ARRAY_MODE
+static int modlist_seq_show(struct seq_file *m, void *v) {
+    seq_printf(m, "%d\n", *(int *)v);
+
+    return 0;
+}
+#else
+static int modlist_seq_show(struct seq_file *m, void *v) {
+#ifdef RBTREE_MODE
+    list_item_t *item = rb_entry(v, list_item_t, node);
+#else
+    list_item_t *item = list_entry(v, list_item_t, links);
+#endif
+
+#ifdef STRING_MODE
+    seq_write(m, item->data->text, item->data->len);
+    seq_putc(m, '\n');
+#else
+    seq_printf(m, "%d\n", item->data);
+#endif
+
+    return 0;
+}
+#endif
+
+static const struct seq_operations modlist_seq_ops = {
+    .start = modlist_seq_start,
+    .next = modlist_seq_next,
+    .stop = modlist_seq_stop,
+    .show = modlist_seq_show,
+};
+
+
+/*****************************************************************************
+ *
+ * Rendered text cache. The text is made by the seq_file iterator itself, on
+ * a seq_file of our own whose buffer is the whole cache.
+ *
+ ****************************************************************************/
+
+/* Drops a reference to r, that is freed with the last one */
+static void render_put(modlist_t *ml, render_t *r) {
+    int last = 0;
+
+    if (r == NULL)
+        return;
+
+    spin_lock(&ml->render_lock);
+    last = (--r->refs == 0);
+    spin_unlock(&ml->render_lock);
+
+    if (last)
+        vfree(r);
+}
+
+/*
+ * Renders the whole list in size chars, a page at a time, taking the read
+ * lock for each one as seq_read does, so the writers are not held off for the
+ * whole walk. A walk the list changes under starts again, a few times at most.
+ * Returns NULL if it does not fit, there is no memory or the list kept on
+ * changing. The list_gen it saw is left in *gen, and the chars per item of
+ * what fitted in *chars (0 if nothing was rendered).
+ */
+static render_t *render_build(modlist_t *ml, size_t size, unsigned long *gen, unsigned int *chars) {
+    modlist_file_t iter;
+    struct seq_file m;
+    render_t *r;
+    unsigned long items;
+    size_t fitted, chunk;
+    loff_t pos;
+    void *v;
+    int tries;
+
+    *chars = 0;
+    r = vmalloc(sizeof(render_t) + size);
+    if (r == NULL)
+        return NULL;
+
+    memset(&m, 0, sizeof(m));
+    m.buf = r->text;
+    m.size = size;
+    m.private = &iter;
+    iter.ml = ml;
+
+    for (tries = 1; ; tries++) {
+        m.count = 0;
+        iter.pos = -1;
+        pos = 0;
+        items = 0;
+        fitted = 0;
+
+        // read before the walk, a change made during it must not go unnoticed
+        *gen = READ_ONCE(ml->list_gen);
+        smp_rmb();
+
+        do {
+            // the iterator goes on from the saved position while the list is the same
+            chunk = m.count + PAGE_SIZE;
+            for (v = modlist_seq_start(&m, &pos); v != NULL && m.count < chunk; v = modlist_seq_next(&m, v, &pos)) {
+                modlist_seq_show(&m, v);
+                if (seq_has_overflowed(&m))
+                    break;
+                fitted = m.count;
+                items++;
+            }
+            modlist_seq_stop(&m, v);
+            cond_resched();
+        } while (v != NULL && !seq_has_overflowed(&m) && READ_ONCE(ml->list_gen) == *gen);
+
+        if (READ_ONCE(ml->list_gen) == *gen)
+            break;
+        // the pages already rendered are of another version of the list
+        if (tries == RENDER_TRIES) {
+            vfree(r);
+            return NULL;
+        }
+    }
+
+    if (items > 0)
+        *chars = DIV_ROUND_UP(fitted, items);
+
+    if (seq_has_overflowed(&m)) {
+        vfree(r);
+        return NULL;
+    }
+
+    r->gen = *gen;
+    r->len = m.count;
+    r->size = size;
+    r->refs = 1;
+    return r;
+}
+
+/* The text of version gen of the list does not fit in max chars (render_lock held) */
+static inline void render_skip(modlist_t *ml, unsigned long gen, unsigned int max) {
+    ml->render_skip_gen = gen;
+    ml->render_skip_max = max;
+}
+
+/*
+ * Returns a reference to the text of the list, rendering it if the cached
+ * one is out of date, and its length in *len. NULL if it can't be cached.
+ */
+static render_t *render_get(modlist_t *ml, size_t *len) {
+    render_t *r, *old = NULL;
+    unsigned int max = READ_ONCE(render_max);
+    unsigned int chars, measured;
+    unsigned long gen, items;
+    size_t size, text;
+
+    // the staged adds do not change list_gen until they are merged
+    stage_flush(ml);
+
+    if (max < RENDER_MIN_SIZE)
+        return NULL;
+
+    spin_lock(&ml->render_lock);
+    gen = READ_ONCE(ml->list_gen);
+    r = ml->render_cache;
+    if (r != NULL && r->gen == gen) {
+        r->refs++;
+        *len = r->len;
+        spin_unlock(&ml->render_lock);
+        return r;
+    }
+    // this version was already found too large, do not walk it again
+    if (ml->render_skip_gen == gen && ml->render_skip_max >= max) {
+        spin_unlock(&ml->render_lock);
+        return NULL;
+    }
+    measured = ml->render_chars;
+    spin_unlock(&ml->render_lock);
+
+    /*
+     * Sized from the items and the chars per item of the last render, with
+     * room for the adds that render_append takes. A text that does not fit
+     * tells how large the items are, so the next try fits or gives up.
+     */
+    items = list_items(ml);
+    chars = measured ? measured : RENDER_ITEM_CHARS;
+    for (size = RENDER_MIN_SIZE; ; ) {
+        text = (size_t)items * chars;
+        if (measured && text > max) {
+            spin_lock(&ml->render_lock);
+            render_skip(ml, gen, max);
+            spin_unlock(&ml->render_lock);
+            return NULL;
+        }
+        size = clamp_t(size_t, PAGE_ALIGN(text + text / 8), size, max);
+        // before the first render, a guess too large for max only takes a measure
+        if (!measured && text > max)
+            size = RENDER_MIN_SIZE;
+
+        r = render_build(ml, size, &gen, &measured);
+        if (measured) {
+            spin_lock(&ml->render_lock);
+            ml->render_chars = measured;
+            spin_unlock(&ml->render_lock);
+            chars = measured;
+        }
+        if (r != NULL)
+            break;
+        if (measured == 0 || size >= max) {
+            // no memory, the list changed, or it did not fit in all the chars it can have
+            if (measured) {
+                spin_lock(&ml->render_lock);
+                render_skip(ml, gen, max);
+                spin_unlock(&ml->render_lock);
+            }
+            return NULL;
+        }
+        // at least half as large again, so the tries are few
+        size += size / 2;
+        items = list_items(ml);
+    }
+
+    spin_lock(&ml->render_lock);
+    if (r->gen == READ_ONCE(ml->list_gen) && (ml->render_cache == NULL || ml->render_cache->gen != r->gen)) {
+        old = ml->render_cache;
+        ml->render_cache = r;
+        r->refs++;
+    }
+    *len = r->len;
+    spin_unlock(&ml->render_lock);
+
+    render_put(ml, old);
+
+    return r;
+}
+
+/*
+ * Reads a snapshot of the list taken at offset 0, with a straight copy of the
+ * cached text. Falls back to seq_file when the list is too large to cache.
+ */
+static ssize_t modlist_read(struct file *filp, char __user *buf, size_t len, loff_t *off) {
+
+    modlist_file_t *state = ((struct seq_file *)filp->private_data)->private;
+    modlist_t *ml = state->ml;
+    u64 start = ktime_get_ns();
+    loff_t pos = *off;
+    ssize_t ret;
+
+    // the answers of the queries come first, ended by a read of 0
+    if (state->answer_len > 0) {
+        ret = min_t(size_t, len, state->answer_len - state->answer_pos);
+        if (ret == 0)
+            state->answer_len = state->answer_pos = 0;
+        else if (copy_to_user(buf, state->answer + state->answer_pos, ret))
+            ret = -EFAULT;
+        else
+            state->answer_pos += ret;
+        return ret;
+    }
+
+    if (*off == 0) {
+        render_put(ml, state->render);
+        state->render = render_get(ml, &state->render_len);
+    }
+
+    if (state->render == NULL) {
+        ret = seq_read(filp, buf, len, off);
+    } else if (*off >= state->render_len) {
+        ret = 0;
+    } else {
+        ret = min_t(size_t, len, state->render_len - *off);
+        if (copy_to_user(buf, state->render->text + *off, ret))
+            ret = -EFAULT;
+        else
+            *off += ret;
+    }
+
+    stats_record(STAT_READ, ktime_get_ns() - start);
+    trace_modlist_read(pos, ret, state->render != NULL);
+
+    return ret;
+}
+
+
+static int modlist_open(struct inode *inode, struct file *file) {
+    modlist_file_t *state;
+
+    state = __seq_open_private(file, &modlist_seq_ops, sizeof(modlist_file_t));
+    if (state == NULL)
+        return -ENOMEM;
+
+    state->ml = PDE_DATA(inode);
+    // nothing saved yet
+    state->pos = -1;
+
+    return 0;
+}
+
+
+#ifndef STRING_MODE
+/*****************************************************************************
+ *
+ * Packed snapshot for /proc/modlist_snap. It is filled by the seq_file
+ * iterator too, one value per item.
+ *
+ ****************************************************************************/
+
+/* Snapshot of the values, shared by the open files and mappings of the same list_gen */
+typedef struct snap_s {
+    struct modlist_snap_header *header; // vmalloc_user'ed, the values follow it
+    size_t size;                        // bytes allocated, page aligned
+    int refs;                           // snap_cache, open files and mappings
+}snap_t;
+
+/*
+ * Protects the snap_cache pointers and refs. A mapping may outlive its list,
+ * so it is not the list's own.
+ */
+static DEFINE_SPINLOCK(snap_lock);
+
+/* Value of the item v of the iterator */
+static inline int iter_value(void *v) {
+#if defined(ARRAY_MODE)
+    return *(int *)v;
+#elif defined(RBTREE_MODE)
+    return rb_entry((struct rb_node *)v, list_item_t, node)->data;
+#else
+    return list_entry((struct list_head *)v, list_item_t, links)->data;
+#endif
+}
+
+static void snap_put(snap_t *snap) {
+    int last = 0;
+
+    if (snap == NULL)
+        return;
+
+    spin_lock(&snap_lock);
+    last = (--snap->refs == 0);
+    spin_unlock(&snap_lock);
+
+    if (last) {
+        vfree(snap->header);
+        kfree(snap);
+    }
+}
+
+/* Copies the whole list under a single read lock acquisition, room for nr values first */
+static snap_t *snap_build(modlist_t *ml, size_t nr) {
+    modlist_file_t iter;
+    struct seq_file m;
+    snap_t *snap;
+    s32 *values;
+    size_t count;
+    unsigned long gen;
+    loff_t pos;
+    void *v;
+
+    snap = kmalloc(sizeof(snap_t), GFP_KERNEL);
+    if (snap == NULL)
+        return NULL;
+
+    for (;; nr *= 2) {
+        snap->size = PAGE_ALIGN(sizeof(struct modlist_snap_header) + nr * sizeof(s32));
+        snap->header = vmalloc_user(snap->size);
+        if (snap->header == NULL) {
+            kfree(snap);
+            return NULL;
+        }
+        values = (s32 *)(snap->header + 1);
+        nr = (snap->size - sizeof(struct modlist_snap_header)) / sizeof(s32);
+
+        memset(&m, 0, sizeof(m));
+        m.private = &iter;
+        iter.ml = ml;
+        iter.pos = -1;
+        pos = 0;
+        count = 0;
+
+        gen = READ_ONCE(ml->list_gen);
+        smp_rmb();
+
+        for (v = modlist_seq_start(&m, &pos); v != NULL && count < nr; v = modlist_seq_next(&m, v, &pos))
+            values[count++] = iter_value(v);
+        modlist_seq_stop(&m, v);
+
+        if (v == NULL) {
+            snap->header->gen = gen;
+            snap->header->count = count;
+            snap->refs = 1;
+            return snap;
+        }
+
+        // too small, try again with twice the room
+        vfree(snap->header);
+    }
+}
+
+/* Returns a reference to a snapshot of the list, building it if the last one is out of date */
+static snap_t *snap_get(modlist_t *ml) {
+    snap_t *snap, *old = NULL;
+    size_t nr = PAGE_SIZE / sizeof(s32);
+
+    stage_flush(ml);
+
+    spin_lock(&snap_lock);
+    snap = ml->snap_cache;
+    if (snap != NULL) {
+        if (snap->header->gen == READ_ONCE(ml->list_gen)) {
+            snap->refs++;
+            spin_unlock(&snap_lock);
+            return snap;
+        }
+        nr = max_t(size_t, nr, snap->header->count);
+    }
+    spin_unlock(&snap_lock);
+
+    snap = snap_build(ml, nr);
+    if (snap == NULL)
+        return NULL;
+
+    spin_lock(&snap_lock);
+    if (snap->header->gen == READ_ONCE(ml->list_gen) &&
+        (ml->snap_cache == NULL || ml->snap_cache->header->gen != snap->header->gen)) {
+        old = ml->snap_cache;
+        ml->snap_cache = snap;
+        snap->refs++;
+    }
+    spin_unlock(&snap_lock);
+
+    snap_put(old);
+
+    return snap;
+}
+
+/* A mapping keeps its snapshot, and the module, while it lasts */
+static void snap_vm_open(struct vm_area_struct *vma) {
+    snap_t *snap = vma->vm_private_data;
+
+    __module_get(THIS_MODULE);
+    spin_lock(&snap_lock);
+    snap->refs++;
+    spin_unlock(&snap_lock);
+}
+
+static void snap_vm_close(struct vm_area_struct *vma) {
+    snap_put(vma->vm_private_data);
+    module_put(THIS_MODULE);
+}
+
+static const struct vm_operations_struct snap_vm_ops = {
+    .open = snap_vm_open,
+    .close = snap_vm_close,
+};
+
+static int modlist_snap_open(struct inode *inode, struct file *file) {
+    file->private_data = snap_get(PDE_DATA(inode));
+
+    return file->private_data ? 0 : -ENOMEM;
+}
+
+static int modlist_snap_release(struct inode *inode, struct file *file) {
+    snap_put(file->private_data);
+
+    return 0;
+}
+
+/* Returns the header of the snapshot of this open file */
+static ssize_t modlist_snap_read(struct file *filp, char __user *buf, size_t len, loff_t *off) {
+
+    snap_t *snap = filp->private_data;
+    size_t nbytes;
+
+    if (*off >= sizeof(struct modlist_snap_header))
+        return 0;
+
+    nbytes = min_t(size_t, len, sizeof(struct modlist_snap_header) - *off);
+    if (copy_to_user(buf, (char *)snap->header + *off, nbytes))
+        return -EFAULT;
+
+    *off += nbytes;
+
+    return nbytes;
+}
+
+/* Maps the live page, and the snapshot of this open file after it */
+static int modlist_snap_mmap(struct file *filp, struct vm_area_struct *vma) {
+
+    modlist_t *ml = PDE_DATA(file_inode(filp));
+    snap_t *snap = filp->private_data;
+    unsigned long size = vma->vm_end - vma->vm_start;
+    unsigned long off;
+    int ret;
+
+    if (vma->vm_pgoff != 0 || size > PAGE_SIZE + snap->size)
+        return -EINVAL;
+
+    if (vma->vm_flags & VM_WRITE)
+        return -EPERM;
+    vma->vm_flags &= ~VM_MAYWRITE;
+
+    ret = vm_insert_page(vma, vma->vm_start, virt_to_page(ml->snap_live));
+    for (off = PAGE_SIZE; ret == 0 && off < size; off += PAGE_SIZE)
+        ret = vm_insert_page(vma, vma->vm_start + off, vmalloc_to_page((char *)snap->header + off - PAGE_SIZE));
+    if (ret)
+        return ret;
+
+    vma->vm_private_data = snap;
+    vma->vm_ops = &snap_vm_ops;
+    snap_vm_open(vma);
+
+    return 0;
+}
+#endif
+
+
+/*****************************************************************************
+ *
+ * Queries. They are answered with the write lock held, in the order of the
+ * commands of their batch, from the aggregates kept by every change.
+ *
+ ****************************************************************************/
+
+#ifdef ARRAY_MODE
+/* First slot of the sorted prefix whose value is above value, or not below it if !above */
+static size_t array_bound(modlist_t *ml, int value, int above) {
+    size_t lo = 0, hi = ml->array_sorted, mid;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (ml->array[mid] < value || (above && ml->array[mid] == value))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+/*
+ * Binary searches over the sorted prefix, and a scan of the values appended
+ * after it: O(log n + tail), until a sort takes the tail into the prefix
+ */
+static unsigned long array_occurrences(modlist_t *ml, int value) {
+    unsigned long n;
+    size_t i;
+
+    n = array_bound(ml, value, 1) - array_bound(ml, value, 0);
+    for (i = ml->array_sorted; i < ml->array_len; i++)
+        n += (ml->array[i] == value);
+
+    return n;
+}
+#endif
+
+/* Occurrences of value in the list */
+static unsigned long query_occurrences(modlist_t *ml, value_t value) {
+#if defined(ARRAY_MODE)
+    return array_occurrences(ml, value);
+#elif defined(RBTREE_MODE)
+    struct rb_node **link, *parent;
+    list_item_t *item = tree_find(ml, value, &link, &parent);
+
+    return item != NULL ? item->count : 0;
+#else
+    index_entry_t *entry = index_lookup(index_bucket(ml, value), value);
+
+    return entry != NULL ? entry->count : 0;
+#endif
+}
+
+/* Smallest value if min, largest if not. The list can't be empty */
+static value_t query_extreme(modlist_t *ml, int min) {
+#if defined(ARRAY_MODE)
+    return min ? ml->min : ml->max;
+#elif defined(RBTREE_MODE)
+    struct rb_node *node = min ? rb_first(&ml->tree) : rb_last(&ml->tree);
+
+    return rb_entry(node, list_item_t, node)->data;
+#else
+    struct rb_node *node = min ? rb_first(&ml->value_order) : rb_last(&ml->value_order);
+
+    return rb_entry(node, index_entry_t, order)->value;
+#endif
+}
+
+/* Appends the answer of a query to the ones the next read of state returns */
+static void query_answer(modlist_t *ml, modlist_cmd_t *cmd, modlist_file_t *state) {
+    char *buf = state->answer + state->answer_len;
+    size_t room = ANSWER_LENGHT - state->answer_len;
+    int n;
+
+    switch (cmd->type) {
+    case CMD_COUNT:
+        n = snprintf(buf, room, "%lu\n", list_items(ml));
+        break;
+    case CMD_CONTAINS:
+        n = snprintf(buf, room, "%d\n", query_occurrences(ml, cmd->value) > 0);
+        break;
+    case CMD_OCCURRENCES:
+        n = snprintf(buf, room, "%lu\n", query_occurrences(ml, cmd->value));
+        break;
+    case CMD_MIN:
+    case CMD_MAX:
+        if (list_items(ml) == 0)
+            n = snprintf(buf, room, "\n");
+        else
+            n = snprintf(buf, room, DATA_PRINT_FORMAT"\n",
+                         DATA_PRINT_ARG(query_extreme(ml, cmd->type == CMD_MIN)));
+        break;
+#ifndef STRING_MODE
+    case CMD_SUM:
+        n = snprintf(buf, room, "%lld\n", ml->sum);
+        break;
+#endif
+    default:
+        return;
+    }
+
+    if (n >= room) {
+        printk(KERN_INFO "Modlist: too many answers not read, query dropped\n");
+        buf[0] = '\0';
+        return;
+    }
+    state->answer_len += n;
+}
+
+
+/*
+ * Parses a command line into cmd, allocating what an add will need.
+ * Unknown commands are ignored (CMD_NONE).
+ */
+static int parse_command(modlist_t *ml, char *line, modlist_cmd_t *cmd) {
+    char command[LINE_LENGHT];
+#ifdef STRING_MODE
+    char value[STRING_LENGHT];
+#endif
+
+    command[0] = '\0';
+    cmd->type = CMD_NONE;
+
+    // parse argument (it seems to work fine if there is no value in input)
+#ifndef STRING_MODE
+    cmd->value = 0;
+    sscanf(line, "%s %d", command, &cmd->value);
+#else
+    value[0] = '\0';
+    sscanf(line, "%s %s", command, value);
+
+    if (!strcasecmp(command, "add") || !strcasecmp(command, "remove") ||
+        !strcasecmp(command, "contains") || !strcasecmp(command, "occurrences")) {
+        cmd->value = mstring_get(value);
+        if (cmd->value == NULL) {
+            printk(KERN_INFO "Modlist: Can't allocate the string\n");
+            return -ENOMEM;
+        }
+    }
+#endif
+
+    // COMMAND: Add <number>
+    if (!strcasecmp(command, "add")) {
+#ifndef ARRAY_MODE
+        cmd->item = alloc_nodepool_t(ml->node_pool);
+        if (cmd->item == NULL) {
+            printk(KERN_INFO "Modlist: Can't add item to list\n");
+#ifdef STRING_MODE
+            mstring_put(cmd->value);
+#endif
+            return -ENOMEM;
+        }
+        cmd->item->data = cmd->value;
+#endif
+        cmd->type = CMD_ADD;
+    }
+    // COMMAND: remove <number>
+    else if (!strcasecmp(command, "remove")) {
+        cmd->type = CMD_REMOVE;
+    }
+    // COMMAND: cleanup
+    else if (!strcasecmp(command, "cleanup")) {
+        cmd->type = CMD_CLEANUP;
+    }
+    // COMMAND: sort
+    else if (!strcasecmp(command, "sort")) {
+        cmd->type = CMD_SORT;
+    }
+    // QUERIES: count, contains <number>, occurrences <number>, min, max, sum
+    else if (!strcasecmp(command, "count")) {
+        cmd->type = CMD_COUNT;
+    }
+    else if (!strcasecmp(command, "contains")) {
+        cmd->type = CMD_CONTAINS;
+    }
+    else if (!strcasecmp(command, "occurrences")) {
+        cmd->type = CMD_OCCURRENCES;
+    }
+    else if (!strcasecmp(command, "min")) {
+        cmd->type = CMD_MIN;
+    }
+    else if (!strcasecmp(command, "max")) {
+        cmd->type = CMD_MAX;
+    }
+#ifndef STRING_MODE
+    else if (!strcasecmp(command, "sum")) {
+        cmd->type = CMD_SUM;
+    }
+#endif
+
+    return 0;
+}
+
+
+/*
+ * Runs nr parsed commands under a single write lock acquisition. The answers
+ * of the queries go to state. It stops at the first one that fails, and the
+ * commands that ran before it are left in *run.
+ */
+static int apply_batch(modlist_t *ml, modlist_cmd_t *batch, int nr, modlist_file_t *state, int *run) {
+
+    modlist_cmd_t *cmd, *first = batch;
+    int ret = 0;
+    u64 start;
+#if defined(ARRAY_MODE)
+    int *old;
+    size_t adds = 0;
+    int cleaned = 0;
+#elif defined(RCU_MODE)
+    list_root_t *new_root;
+    LIST_HEAD(retired);
+#elif defined(LIST_MODE)
+    list_item_t *pos, *temp;
+#endif
+
+#ifdef STAGED_ADD
+    // the adds before any other command do not need the lock
+    for (; nr > 0 && batch->type == CMD_ADD; batch++, nr--) {
+        start = ktime_get_ns();
+        trace_modlist_add(DATA_PRINT_ARG(batch->value));
+        llist_add(&(batch->item->stage), &ml->staged);
+        stats_record(STAT_ADD, ktime_get_ns() - start);
+    }
+    *run = batch - first;
+    if (nr == 0)
+        return 0;
+#endif
+
+#ifdef ARRAY_MODE
+    for (cmd = batch; cmd < batch + nr; cmd++)
+        adds += (cmd->type == CMD_ADD);
+
+    ret = array_write_lock(ml, adds, &old);
+    if (ret) {
+        printk(KERN_INFO "Modlist: Can't add item to list\n");
+        *run = batch - first;
+        return ret;
+    }
+#else
+    list_write_lock(ml);
+    stage_merge(ml);
+#endif
+
+    for (cmd = batch; cmd < batch + nr; cmd++) {
+        start = ktime_get_ns();
+
+        switch (cmd->type) {
+
+        case CMD_ADD:
+            trace_modlist_add(DATA_PRINT_ARG(cmd->value));
+#if defined(ARRAY_MODE)
+            ml->array[ml->array_len++] = cmd->value;
+            sum_add(ml, cmd->value, 1);
+            extremes_add(ml, cmd->value);
+            array_sorted_extend(ml);
+            render_append(ml, cmd->value);
+            list_modified(ml);
+#elif defined(RBTREE_MODE)
+            tree_add(ml, cmd->item);
+#else
+            if (index_add(ml, cmd->item)) {
+                free_item(ml, cmd->item);
+                printk(KERN_INFO "Modlist: Can't add item to list\n");
+                ret = -ENOMEM;
+                break;
+            }
+            item_add_tail(&(cmd->item->links), &ml_list(ml));
+            sorted_extend(ml);
+            render_append(ml, cmd->item->data);
+            list_modified(ml);
+#endif
+            break;
+
+        case CMD_REMOVE:
+#if defined(ARRAY_MODE)
+            array_remove(ml, cmd->value);
+#elif defined(RBTREE_MODE)
+            tree_remove(ml, cmd->value);
+#else
+            index_remove(ml, cmd->value);
+#endif
+            break;
+
+        case CMD_CLEANUP:
+            trace_modlist_cleanup(list_items(ml));
+#if defined(ARRAY_MODE)
+            // the room of the adds of this batch is still needed
+            ml->array_len = 0;
+            ml->array_sorted = 0;
+            aggregates_clear(ml);
+            cleaned = 1;
+            list_modified(ml);
+#elif defined(RBTREE_MODE)
+            tree_clear(ml);
+            shrink_nodepool_t(ml->node_pool);
+#elif defined(RCU_MODE)
+            new_root = create_root();
+            if (new_root == NULL) {
+                printk(KERN_INFO "Modlist: Can't cleanup the list\n");
+                ret = -ENOMEM;
+                break;
+            }
+            index_clear(ml);
+            list_add_tail(&swap_root(ml, new_root)->retired, &retired);
+#else
+            index_clear(ml);
+            list_for_each_entry_safe(pos, temp, &ml_list(ml), links) {
+                list_del(&(pos->links));
+                free_item(ml, pos);
+            }
+            ml->sorted_tail = &ml_list(ml);
+            shrink_nodepool_t(ml->node_pool);
+            shrink_nodepool_t(ml->entry_pool);
+            list_modified(ml);
+#endif
+            break;
+
+        case CMD_SORT:
+            trace_modlist_sort(list_items(ml));
+#if defined(ARRAY_MODE)
+            array_sort(ml);
+#elif defined(RBTREE_MODE)
+            // the tree is always sorted
+#elif defined(RCU_MODE)
+            if (ml->sorted_tail == ml_list(ml).prev)
+                break;
+            new_root = sorted_copy(ml);
+            if (new_root == NULL) {
+                printk(KERN_INFO "Modlist: Can't sort the list\n");
+                ret = -ENOMEM;
+                break;
+            }
+            list_add_tail(&swap_root(ml, new_root)->retired, &retired);
+            ml->sorted_tail = ml_list(ml).prev;
+#else
+            if (ml->sorted_tail != ml_list(ml).prev) {
+                merge_sort_tail(ml, &ml_list(ml), ml->sorted_tail);
+                ml->sorted_tail = ml_list(ml).prev;
+                list_modified(ml);
+            }
+#endif
+            break;
+
+        case CMD_COUNT:
+        case CMD_CONTAINS:
+        case CMD_OCCURRENCES:
+        case CMD_MIN:
+        case CMD_MAX:
+        case CMD_SUM:
+            query_answer(ml, cmd, state);
+            break;
+        }
+
+        stats_record(cmd_stat[cmd->type], ktime_get_ns() - start);
+        if (ret)
+            break;
+    }
+    *run = cmd - first;
+
+    list_write_unlock(ml);
+
+#ifndef ARRAY_MODE
+    // the nodes of the adds after the one that failed were never linked
+    if (ret) {
+        while (++cmd < batch + nr) {
+            if (cmd->type == CMD_ADD)
+                free_item(ml, cmd->item);
+        }
+    }
+#endif
+
+#ifdef ARRAY_MODE
+    vfree(old);
+    if (cleaned)
+        array_release_empty(ml);
+#endif
+
+#ifdef RCU_MODE
+    if (!list_empty(&retired)) {
+        release_roots(ml, &retired);
+        shrink_nodepool_t(ml->node_pool);
+        shrink_nodepool_t(ml->entry_pool);
+    }
+#endif
+
+#ifdef STRING_MODE
+    // the strings of the adds belong to their nodes now
+    for (cmd = batch; cmd < batch + nr; cmd++) {
+        if (cmd->type == CMD_REMOVE || cmd->type == CMD_CONTAINS || cmd->type == CMD_OCCURRENCES)
+            mstring_put(cmd->value);
+    }
+#endif
+
+    return ret;
+}
+
+
+/*
+ * Splits the input in lines and runs them in batches. The chars after the
+ * last '\n' are kept in the open file state until the next write (or close).
+ * When a line fails, the chars of the lines before it are returned (the error
+ * if it is the first one), as any write that is not done in full.
+ */
+static ssize_t modlist_write(struct file *filp, const char __user *buf, size_t len, loff_t *off) {
+
+    modlist_file_t *state = ((struct seq_file *)filp->private_data)->private;
+    modlist_t *ml = state->ml;
+    modlist_cmd_t *batch;
+    char *chunk, *line, *end, *nl;
+    size_t done, nbytes, seg;
+    size_t consumed = 0;        // chars of the lines parsed (or kept in pending)
+    size_t flushed = 0;         // chars of the lines of the batches already run
+    int nr = 0, run, ret = 0;
+
+    chunk = kmalloc(WRITE_CHUNK, GFP_KERNEL);
+    batch = kmalloc(BATCH_LENGHT * sizeof(modlist_cmd_t), GFP_KERNEL);
+    if (chunk == NULL || batch == NULL) {
+        ret = -ENOMEM;
+        goto out;
+    }
+
+    for (done = 0; done < len; done += nbytes) {
+        nbytes = min_t(size_t, len - done, WRITE_CHUNK);
+        if (copy_from_user(chunk, buf + done, nbytes)) {
+            // the start of a line split here is in pending already
+            consumed = done;
+            ret = -EFAULT;
+            goto out;
+        }
+
+        for (line = chunk, end = chunk + nbytes; line < end; line = nl + 1) {
+            nl = memchr(line, '\n', end - line);
+            seg = (nl != NULL ? nl : end) - line;
+
+            if (state->pending_len + seg >= LINE_LENGHT) {
+                printk(KERN_INFO "Modlist: input too large\n");
+                state->pending_len = 0;
+                ret = -ENOSPC;
+                goto out;
+            }
+            memcpy(state->pending + state->pending_len, line, seg);
+            state->pending_len += seg;
+
+            // the line goes on in the next chunk
+            if (nl == NULL)
+                break;
+
+            state->pending[state->pending_len] = '\0';
+            state->pending_len = 0;
+
+            ret = parse_command(ml, state->pending, &batch[nr]);
+            if (ret)
+                goto out;
+            consumed = done + (nl + 1 - chunk);
+            if (batch[nr].type != CMD_NONE)
+                batch[nr++].end = consumed;
+
+            if (nr == BATCH_LENGHT) {
+                ret = apply_batch(ml, batch, nr, state, &run);
+                if (ret) {
+                    consumed = (run > 0) ? batch[run - 1].end : flushed;
+                    nr = 0;
+                    goto out;
+                }
+                nr = 0;
+                flushed = consumed;
+            }
+        }
+    }
+    consumed = len;
+
+out:
+    // the lines before a failed one are run all the same
+    if (nr > 0) {
+        int batch_ret = apply_batch(ml, batch, nr, state, &run);
+        if (batch_ret) {
+            consumed = (run > 0) ? batch[run - 1].end : flushed;
+            ret = batch_ret;
+        }
+    }
+    kfree(batch);
+    kfree(chunk);
+
+    if (consumed == 0)
+        return ret;
+    *off += consumed;
+    return consumed;
+}
+
+
+/* Runs the last line if it was not ended with '\n' */
+static int modlist_release(struct inode *inode, struct file *file) {
+
+    modlist_file_t *state = ((struct seq_file *)file->private_data)->private;
+    modlist_t *ml = state->ml;
+    modlist_cmd_t cmd;
+    int run;
+
+    if (state->pending_len > 0) {
+        state->pending[state->pending_len] = '\0';
+        if (!parse_command(ml, state->pending, &cmd) && cmd.type != CMD_NONE)
+            apply_batch(ml, &cmd, 1, state, &run);
+    }
+
+    render_put(ml, state->render);
+
+    return seq_release_private(inode, file);
+}
+
+
+#if defined(ARRAY_MODE)
+/*
+ * MODLIST_BULK_ADD and MODLIST_BULK_REPLACE. The values are copied to a
+ * buffer of their own first, that becomes the array itself on a replace.
+ */
+static long bulk_insert(modlist_t *ml, const s32 __user *values, u32 count, int replace) {
+
+    int *kvalues, *old;
+    int lo = 0, hi = 0;
+    s64 sum = 0;
+    u32 i;
+    int ret;
+
+    kvalues = vmalloc(max_t(u32, count, 1) * sizeof(int));
+    if (kvalues == NULL)
+        return -ENOMEM;
+
+    if (copy_from_user(kvalues, values, count * sizeof(int))) {
+        vfree(kvalues);
+        return -EFAULT;
+    }
+
+    // the aggregates of the new values, out of the lock
+    for (i = 0; i < count; i++) {
+        sum += kvalues[i];
+        lo = (i == 0 || kvalues[i] < lo) ? kvalues[i] : lo;
+        hi = (i == 0 || kvalues[i] > hi) ? kvalues[i] : hi;
+    }
+
+    if (replace) {
+        list_write_lock(ml);
+        old = ml->array;
+        ml->array = kvalues;
+        ml->array_cap = max_t(u32, count, 1);
+        ml->array_len = count;
+        ml->array_sorted = 0;
+        array_sorted_extend(ml);
+        aggregates_clear(ml);
+        ml->sum = sum;
+        if (count > 0) {
+            extremes_add(ml, lo);
+            extremes_add(ml, hi);
+        }
+        list_modified(ml);
+        list_write_unlock(ml);
+
+        vfree(old);
+        return 0;
+    }
+
+    ret = array_write_lock(ml, count, &old);
+    if (ret == 0) {
+        memcpy(ml->array + ml->array_len, kvalues, count * sizeof(int));
+        ml->array_len += count;
+        array_sorted_extend(ml);
+        ml->sum += sum;
+        if (count > 0) {
+            extremes_add(ml, lo);
+            extremes_add(ml, hi);
+        }
+        list_modified(ml);
+        list_write_unlock(ml);
+    }
+
+    vfree(old);
+    vfree(kvalues);
+
+    return ret;
+}
+#elif !defined(STRING_MODE) && defined(RBTREE_MODE)
+/*
+ * MODLIST_BULK_ADD and MODLIST_BULK_REPLACE. The values are sorted before
+ * taking the lock, so every distinct value is looked up in the tree only once,
+ * and just the nodes that may be needed are allocated.
+ */
+static long bulk_insert(modlist_t *ml, const s32 __user *values, u32 count, int replace) {
+
+    struct rb_node **link, *parent;
+    list_item_t *item, *chain = NULL;
+    s32 *kvalues;
+    u32 i, run, distinct;
+    int ret = 0;
+
+    kvalues = vmalloc(max_t(u32, count, 1) * sizeof(s32));
+    if (kvalues == NULL)
+        return -ENOMEM;
+
+    if (copy_from_user(kvalues, values, count * sizeof(s32))) {
+        ret = -EFAULT;
+        goto out;
+    }
+
+    sort(kvalues, count, sizeof(s32), cmp_int, NULL);
+
+    for (i = 0, distinct = 0; i < count; i++) {
+        if (i == 0 || kvalues[i] != kvalues[i - 1])
+            distinct++;
+    }
+
+    if (distinct > 0) {
+        chain = alloc_chain_nodepool_t(ml->node_pool, distinct);
+        if (chain == NULL) {
+            ret = -ENOMEM;
+            goto out;
+        }
+    }
+
+    list_write_lock(ml);
+
+    if (replace)
+        tree_clear(ml);
+
+    for (i = 0; i < count; i += run) {
+        for (run = 1; i + run < count && kvalues[i + run] == kvalues[i]; run++)
+            ;
+        ml->nr_items += run;
+        sum_add(ml, kvalues[i], run);
+        item = tree_find(ml, kvalues[i], &link, &parent);
+        if (item != NULL) {
+            item->count += run;
+        } else {
+            item = chain;
+            chain = *(list_item_t **)chain;
+            item->data = kvalues[i];
+            tree_link(ml, item, run, link, parent);
+        }
+    }
+    list_modified(ml);
+
+    list_write_unlock(ml);
+
+    // nodes of the values that were already in the tree
+    free_chain_nodepool_t(ml->node_pool, chain);
+    if (replace)
+        shrink_nodepool_t(ml->node_pool);
+
+out:
+    vfree(kvalues);
+
+    return ret;
+}
+#elif !defined(STRING_MODE)
+/* Gives back the nodes of a private list */
+static void bulk_free(modlist_t *ml, struct list_head *items) {
+    list_item_t *pos, *temp;
+
+    list_for_each_entry_safe(pos, temp, items, links) {
+        free_item(ml, pos);
+    }
+}
+
+/* Builds the nodes of count user values into items, without taking any lock */
+static int bulk_build(modlist_t *ml, const s32 __user *values, u32 count, struct list_head *items) {
+
+    list_item_t *item, *chain = NULL;
+    s32 *kvalues;
+    u32 done, nr, i;
+    int ret = 0;
+
+    if (count == 0)
+        return 0;
+
+    kvalues = kmalloc(BULK_CHUNK, GFP_KERNEL);
+    chain = alloc_chain_nodepool_t(ml->node_pool, count);
+    if (kvalues == NULL || chain == NULL) {
+        ret = -ENOMEM;
+        goto out;
+    }
+
+    for (done = 0; done < count; done += nr) {
+        nr = min_t(u32, count - done, BULK_CHUNK / sizeof(s32));
+        if (copy_from_user(kvalues, values + done, nr * sizeof(s32))) {
+            ret = -EFAULT;
+            goto out;
+        }
+        for (i = 0; i < nr; i++) {
+            item = chain;
+            chain = *(list_item_t **)chain;
+            item->data = kvalues[i];
+            list_add_tail(&(item->links), items);
+        }
+    }
+
+out:
+    if (ret)
+        bulk_free(ml, items);
+    free_chain_nodepool_t(ml->node_pool, chain);
+    kfree(kvalues);
+
+    return ret;
+}
+
+/* MODLIST_BULK_ADD and MODLIST_BULK_REPLACE */
+static long bulk_insert(modlist_t *ml, const s32 __user *values, u32 count, int replace) {
+
+    list_item_t *pos, *temp;
+    LIST_HEAD(items);
+#ifdef RCU_MODE
+    list_root_t *new_root = NULL;
+    LIST_HEAD(retired);
+#else
+    LIST_HEAD(old_items);
+#endif
+    int ret;
+
+    ret = bulk_build(ml, values, count, &items);
+    if (ret)
+        return ret;
+
+#ifdef RCU_MODE
+    if (replace) {
+        new_root = create_root();
+        if (new_root == NULL) {
+            bulk_free(ml, &items);
+            return -ENOMEM;
+        }
+    }
+#endif
+
+    list_write_lock(ml);
+    stage_merge(ml);
+
+    if (replace) {
+        index_clear(ml);
+#ifndef RCU_MODE
+        list_splice_init(&ml_list(ml), &old_items);
+        ml->sorted_tail = &ml_list(ml);
+#endif
+    }
+
+    list_for_each_entry_safe(pos, temp, &items, links) {
+        if (index_add(ml, pos)) {
+            list_del(&(pos->links));
+            free_item(ml, pos);
+            ret = -ENOMEM;
+        }
+    }
+
+#ifdef RCU_MODE
+    if (replace) {
+        list_splice(&items, &new_root->head);
+        list_add_tail(&swap_root(ml, new_root)->retired, &retired);
+    } else {
+        item_splice_tail(&items, &ml_list(ml));
+        list_modified(ml);
+    }
+    sorted_extend(ml);
+#else
+    list_splice_tail(&items, &ml_list(ml));
+    sorted_extend(ml);
+    list_modified(ml);
+#endif
+
+    list_write_unlock(ml);
+
+    // the replaced nodes are not reachable any more
+#ifdef RCU_MODE
+    release_roots(ml, &retired);
+#else
+    bulk_free(ml, &old_items);
+#endif
+
+    return ret;
+}
+#endif
+
+#ifndef STRING_MODE
+/* MODLIST_BULK_REMOVE */
+static long bulk_remove(modlist_t *ml, const s32 __user *values, u32 count) {
+    s32 *kvalues;
+#ifndef ARRAY_MODE
+    u32 i;
+#endif
+
+    if (count == 0)
+        return 0;
+
+    kvalues = vmalloc(count * sizeof(s32));
+    if (kvalues == NULL)
+        return -ENOMEM;
+
+    if (copy_from_user(kvalues, values, count * sizeof(s32))) {
+        vfree(kvalues);
+        return -EFAULT;
+    }
+
+#ifdef ARRAY_MODE
+    // a single compaction pass looks every value up in the sorted set
+    sort(kvalues, count, sizeof(s32), cmp_int, NULL);
+
+    list_write_lock(ml);
+    array_remove_set(ml, kvalues, count);
+    list_write_unlock(ml);
+#else
+    list_write_lock(ml);
+    stage_merge(ml);
+    for (i = 0; i < count; i++) {
+#ifdef RBTREE_MODE
+        tree_remove(ml, kvalues[i]);
+#else
+        index_remove(ml, kvalues[i]);
+#endif
+    }
+    list_write_unlock(ml);
+#endif
+
+    vfree(kvalues);
+
+    return 0;
+}
+
+static long modlist_ioctl(struct file *filp, unsigned int cmd, unsigned long arg) {
+    modlist_t *ml = ((modlist_file_t *)((struct seq_file *)filp->private_data)->private)->ml;
+    struct modlist_bulk bulk;
+    const s32 __user *values;
+    u64 start = ktime_get_ns();
+    long ret = -EINVAL;
+
+    if (cmd != MODLIST_IOC_BULK)
+        return -ENOTTY;
+
+    if (copy_from_user(&bulk, (void __user *)arg, sizeof(bulk)))
+        return -EFAULT;
+
+    if (bulk.count > MODLIST_BULK_MAX)
+        return -E2BIG;
+
+    values = (const s32 __user *)(unsigned long)bulk.values;
+    trace_modlist_bulk(bulk.cmd, bulk.count);
+
+    switch (bulk.cmd) {
+    case MODLIST_BULK_ADD:
+        ret = bulk_insert(ml, values, bulk.count, 0);
+        break;
+    case MODLIST_BULK_REPLACE:
+        ret = bulk_insert(ml, values, bulk.count, 1);
+        break;
+    case MODLIST_BULK_REMOVE:
+        ret = bulk_remove(ml, values, bulk.count);
+        break;
+    }
+
+    stats_record(STAT_BULK, ktime_get_ns() - start);
+
+    return ret;
+}
+#endif
+
+
+#ifndef ARRAY_MODE
+/* Prints the usage of pool into info, returns the number of chars */
+static int print_pool(char *info, int size, const char *name, nodepool_t *pool) {
+    unsigned long footprint, in_use;
+
+    footprint = footprint_nodepool_t(pool);
+    in_use = pool->in_use;
+
+    return snprintf(info, size,
+        "%s:\n"
+        "  node size:       %u bytes\n"
+        "  nodes per chunk: %u\n"
+        "  nodes in use:    %lu\n"
+        "  chunks:          %lu\n"
+        "  footprint:       %lu bytes\n"
+        "  bytes per node:  %lu (vmalloc: %lu)\n"
+        "  hits:            %lu\n"
+        "  misses:          %lu\n",
+        name, pool->node_size, pool->nodes_per_chunk, in_use,
+        pool->nr_chunks, footprint,
+        in_use ? footprint / in_use : 0, PAGE_SIZE,
+        pool->hits, pool->misses);
+}
+#endif
+
+/* Reports the pools of the default list */
+static ssize_t modlist_pool_read(struct file *filp, char __user *buf, size_t len, loff_t *off) {
+
+    modlist_t *ml = default_list;
+    char info[POOL_INFO_LENGHT];
+    int nchars;
+#ifdef ARRAY_MODE
+    size_t len_now, cap_now;
+#endif
+
+    if ((*off) > 0)
+        return 0;
+
+#ifdef ARRAY_MODE
+    list_read_lock(ml);
+    len_now = ml->array_len;
+    cap_now = ml->array_cap;
+    list_read_unlock(ml);
+#endif
+
+    nchars = snprintf(info, POOL_INFO_LENGHT,
+#ifdef STRING_MODE
+        "mode: string\n"
+#else
+        "mode: int\n"
+#endif
+#if defined(ARRAY_MODE)
+        "storage: array\n"
+        "  values:          %zu\n"
+        "  capacity:        %zu\n"
+        "  footprint:       %zu bytes\n"
+        "  bytes per value: %zu\n",
+        len_now, cap_now, cap_now * sizeof(int),
+        len_now ? cap_now * sizeof(int) / len_now : 0);
+#elif defined(RBTREE_MODE)
+        "storage: rbtree\n");
+    nchars += print_pool(info + nchars, POOL_INFO_LENGHT - nchars, "tree nodes", ml->node_pool);
+#else
+        "storage: list\n"
+        "index buckets: %u (%lu bytes)\n",
+        1U << index_bits, sizeof(struct hlist_head) << index_bits);
+    nchars += print_pool(info + nchars, POOL_INFO_LENGHT - nchars, "list nodes", ml->node_pool);
+    nchars += print_pool(info + nchars, POOL_INFO_LENGHT - nchars, "index entries", ml->entry_pool);
+#endif
+
+    if (nchars > len)
+        return -ENOSPC;
+
+    if (copy_to_user(buf, info, nchars)) {
+        return -EFAULT;
+    }
+
+    *off += nchars;
+
+    return nchars;
+}
+
+
+/* Memory used by a list and the caches made from it, not its strings */
+static unsigned long modlist_footprint(modlist_t *ml) {
+    unsigned long bytes = 0;
+
+#ifdef LIST_MODE
+    bytes += footprint_nodepool_t(ml->entry_pool);
+    bytes += sizeof(struct hlist_head) << index_bits;
+#endif
+#ifdef ARRAY_MODE
+    list_read_lock(ml);
+    bytes += ml->array_cap * sizeof(int);
+    list_read_unlock(ml);
+#else
+    bytes += footprint_nodepool_t(ml->node_pool);
+#endif
+
+    spin_lock(&ml->render_lock);
+    if (ml->render_cache != NULL)
+        bytes += ml->render_cache->size;
+    spin_unlock(&ml->render_lock);
+#ifndef STRING_MODE
+    spin_lock(&snap_lock);
+    if (ml->snap_cache != NULL)
+        bytes += ml->snap_cache->size;
+    spin_unlock(&snap_lock);
+#endif
+
+    return bytes;
+}
+
+static const char *stat_names[NR_STATS] = {
+    "add", "remove", "cleanup", "sort", "read", "bulk", "query", "lock wait", "lock hold"
+};
+
+static int modlist_stats_show(struct seq_file *m, void *v) {
+    modlist_stats_t *total, *cpu_stats;
+    modlist_t *ml;
+    unsigned long items, bytes;
+    int cpu, i, b, last = 0;
+
+    total = kzalloc(sizeof(modlist_stats_t), GFP_KERNEL);
+    if (total == NULL)
+        return -ENOMEM;
+
+    // no lock, every CPU may be counting something right now
+    for_each_possible_cpu(cpu) {
+        cpu_stats = per_cpu_ptr(&modlist_stats, cpu);
+        for (i = 0; i < NR_STATS; i++) {
+            total->count[i] += READ_ONCE(cpu_stats->count[i]);
+            total->ns[i] += READ_ONCE(cpu_stats->ns[i]);
+            for (b = 0; b < STATS_BUCKETS; b++)
+                total->hist[i][b] += READ_ONCE(cpu_stats->hist[i][b]);
+        }
+    }
+
+    // the default list and every named one
+    mutex_lock(&named_lock);
+    items = list_items(default_list);
+    bytes = modlist_footprint(default_list);
+    list_for_each_entry(ml, &named_lists, links) {
+        items += list_items(ml);
+        bytes += modlist_footprint(ml);
+    }
+    mutex_unlock(&named_lock);
+#ifdef STRING_MODE
+    // the strings are shared by all of them
+    bytes += sizeof(intern_table);
+    spin_lock_bh(&intern_lock);
+    bytes += intern_bytes;
+    spin_unlock_bh(&intern_lock);
+#endif
+
+    seq_printf(m, "items:     %lu\n", items);
+    seq_printf(m, "footprint: %lu bytes\n\n", bytes);
+
+    seq_printf(m, "%-10s %12s %16s %12s\n", "operation", "count", "total ns", "average ns");
+    for (i = 0; i < NR_STATS; i++) {
+        seq_printf(m, "%-10s %12lu %16llu %12llu\n", stat_names[i], total->count[i],
+                   total->ns[i], total->count[i] ? div64_u64(total->ns[i], total->count[i]) : 0);
+    }
+
+    // only up to the largest bucket in use
+    for (i = 0; i < NR_STATS; i++) {
+        for (b = last + 1; b < STATS_BUCKETS; b++) {
+            if (total->hist[i][b])
+                last = b;
+        }
+    }
+
+    seq_printf(m, "\nlatency histogram, ns below\n%-12s", "");
+    for (i = 0; i < NR_STATS; i++)
+        seq_printf(m, " %10s", stat_names[i]);
+    seq_putc(m, '\n');
+
+    for (b = 0; b <= last; b++) {
+        if (b == STATS_BUCKETS - 1)
+            seq_printf(m, "%-12s", "more");
+        else
+            seq_printf(m, "%-12llu", 1ULL << b);
+        for (i = 0; i < NR_STATS; i++)
+            seq_printf(m, " %10lu", total->hist[i][b]);
+        seq_putc(m, '\n');
+    }
+
+    kfree(total);
+
+    return 0;
+}
+
+static int modlist_stats_open(struct inode *inode, struct file *file) {
+    return single_open(file, modlist_stats_show, NULL);
+}
+
+static const struct file_operations proc_entry_fops = {
+    .open = modlist_open,
+    .read = modlist_read,
+    .llseek = seq_lseek,
+    .write = modlist_write,
+    .release = modlist_release,
+#ifndef STRING_MODE
+    .unlocked_ioctl = modlist_ioctl,
+    .compat_ioctl = modlist_ioctl,
+#endif
+};
+
+static const struct file_operations pool_proc_entry_fops = {
+    .read = modlist_pool_read,
+};
+
+static const struct file_operations stats_proc_entry_fops = {
+    .open = modlist_stats_open,
+    .read = seq_read,
+    .llseek = seq_lseek,
+    .release = single_release,
+};
+
+#ifndef STRING_MODE
+static const struct file_operations snap_proc_entry_fops = {
+    .open = modlist_snap_open,
+    .read = modlist_snap_read,
+    .mmap = modlist_snap_mmap,
+    .release = modlist_snap_release,
+};
+#endif
+
+/*****************************************************************************
+ * Lists
+ *****************************************************************************/
+
+/* Allocates an empty list with its lock, pools and index, NULL without memory */
+static modlist_t *modlist_create(const char *name) {
+    modlist_t *ml;
+
+    ml = kzalloc(sizeof(modlist_t), GFP_KERNEL);
+    if (ml == NULL)
+        return NULL;
+    strlcpy(ml->name, name, NAME_LENGHT);
+
+#if defined(RCU_MODE)
+    mutex_init(&ml->wmtx);
+#elif !defined(TEST_NO_LOCK)
+    rwlock_init(&ml->sp);
+#endif
+    spin_lock_init(&ml->render_lock);
+#ifdef STAGED_ADD
+    init_llist_head(&ml->staged);
+#endif
+
+#if defined(RCU_MODE)
+    RCU_INIT_POINTER(ml->root, create_root());
+    if (rcu_access_pointer(ml->root) == NULL)
+        goto out_list;
+#elif defined(RBTREE_MODE)
+    ml->tree = RB_ROOT;
+#elif defined(LIST_MODE)
+    INIT_LIST_HEAD(&ml->list);
+#endif
+#ifdef LIST_MODE
+    ml->sorted_tail = &ml_list(ml);
+    ml->value_order = RB_ROOT;
+#endif
+
+#ifndef ARRAY_MODE
+    ml->node_pool = create_nodepool_t(sizeof(list_item_t));
+    if (ml->node_pool == NULL)
+        goto out_root;
+#endif
+
+#ifdef LIST_MODE
+    ml->entry_pool = create_nodepool_t(sizeof(index_entry_t));
+    if (ml->entry_pool == NULL)
+        goto out_node_pool;
+
+    ml->value_index = vzalloc(sizeof(struct hlist_head) << index_bits);
+    if (ml->value_index == NULL)
+        goto out_entry_pool;
+#endif
+
+#ifndef STRING_MODE
+    ml->snap_live = (struct modlist_snap_live *)get_zeroed_page(GFP_KERNEL);
+    if (ml->snap_live == NULL)
+        goto out_index;
+#endif
+
+    return ml;
+
+#ifndef STRING_MODE
+out_index:
+#endif
+#ifdef LIST_MODE
+    vfree(ml->value_index);
+out_entry_pool:
+    destroy_nodepool_t(ml->entry_pool);
+out_node_pool:
+#endif
+#ifndef ARRAY_MODE
+    destroy_nodepool_t(ml->node_pool);
+out_root:
+#endif
+#ifdef RCU_MODE
+    kfree(rcu_access_pointer(ml->root));
+out_list:
+#endif
+    kfree(ml);
+    return NULL;
+}
+
+/* Frees a list once its /proc entries are gone, nobody can reach it */
+static void modlist_destroy(modlist_t *ml) {
+#if defined(STRING_MODE) && !defined(RBTREE_MODE)
+    list_item_t *pos, *temp;
+
+    // the strings are shared with the other lists, only its references go
+    list_write_lock(ml);
+    stage_merge(ml);
+    list_for_each_entry_safe(pos, temp, &ml_list(ml), links) {
+        release_item(ml, pos);
+    }
+    list_write_unlock(ml);
+#elif defined(STRING_MODE)
+    list_write_lock(ml);
+    tree_clear(ml);
+    list_write_unlock(ml);
+#endif
+
+    render_put(ml, ml->render_cache);
+#ifndef STRING_MODE
+    snap_put(ml->snap_cache);
+    free_page((unsigned long)ml->snap_live);
+#endif
+
+    // free list resources (every node lives in a pool chunk)
+#ifdef RCU_MODE
+    rcu_barrier();  // wait for the pending release_item callbacks
+    kfree(rcu_access_pointer(ml->root));
+#elif defined(ARRAY_MODE)
+    vfree(ml->array);
+#endif
+#ifdef LIST_MODE
+    vfree(ml->value_index);
+    destroy_nodepool_t(ml->entry_pool);
+#endif
+#ifndef ARRAY_MODE
+    destroy_nodepool_t(ml->node_pool);
+#endif
+    kfree(ml);
+}
+
+/* Names of /proc/modlists entries: letters, digits, '_' and '-' */
+static int valid_name(const char *name) {
+    size_t i, len = strlen(name);
+
+    if (len == 0 || len >= NAME_LENGHT || !strcmp(name, "control"))
+        return 0;
+    for (i = 0; i < len; i++) {
+        if (!isalnum(name[i]) && name[i] != '_' && name[i] != '-')
+            return 0;
+    }
+    return 1;
+}
+
+/* Named list called name, NULL if there is none (named_lock held) */
+static modlist_t *named_find(const char *name) {
+    modlist_t *ml;
+
+    list_for_each_entry(ml, &named_lists, links) {
+        if (!strcmp(ml->name, name))
+            return ml;
+    }
+    return NULL;
+}
+
+/* Removes the /proc entries of a named list, waiting for the calls in progress */
+static void named_unregister(modlist_t *ml) {
+#ifndef STRING_MODE
+    char snap_name[NAME_LENGHT + 5];
+
+    snprintf(snap_name, sizeof(snap_name), "%s.snap", ml->name);
+    remove_proc_entry(snap_name, lists_dir);
+#endif
+    remove_proc_entry(ml->name, lists_dir);
+}
+
+static int named_create(const char *name) {
+    modlist_t *ml;
+#ifndef STRING_MODE
+    char snap_name[NAME_LENGHT + 5];
+#endif
+    int ret = -ENOMEM;
+
+    mutex_lock(&named_lock);
+    if (named_find(name) != NULL) {
+        ret = -EEXIST;
+        goto out;
+    }
+
+    ml = modlist_create(name);
+    if (ml == NULL)
+        goto out;
+
+    if (proc_create_data(name, 0666, lists_dir, &proc_entry_fops, ml) == NULL)
+        goto out_list;
+#ifndef STRING_MODE
+    snprintf(snap_name, sizeof(snap_name), "%s.snap", ml->name);
+    if (proc_create_data(snap_name, 0444, lists_dir, &snap_proc_entry_fops, ml) == NULL) {
+        remove_proc_entry(name, lists_dir);
+        goto out_list;
+    }
+#endif
+
+    list_add_tail(&ml->links, &named_lists);
+    mutex_unlock(&named_lock);
+    return 0;
+
+out_list:
+    modlist_destroy(ml);
+out:
+    mutex_unlock(&named_lock);
+    return ret;
+}
+
+/* The name is not free until the entries are gone, so named_lock is kept */
+static int named_delete(const char *name) {
+    modlist_t *ml;
+
+    mutex_lock(&named_lock);
+    ml = named_find(name);
+    if (ml == NULL) {
+        mutex_unlock(&named_lock);
+        return -ENOENT;
+    }
+    list_del(&ml->links);
+    named_unregister(ml);
+    mutex_unlock(&named_lock);
+
+    modlist_destroy(ml);
+    return 0;
+}
+
+/* create <name> or delete <name>, one command per write */
+static ssize_t modlist_control_write(struct file *filp, const char __user *buf, size_t len, loff_t *off) {
+
+    char line[CONTROL_LENGHT];
+    char command[CONTROL_LENGHT];
+    char name[CONTROL_LENGHT];
+    int ret;
+
+    if (len >= CONTROL_LENGHT)
+        return -ENOSPC;
+
+    if (copy_from_user(line, buf, len))
+        return -EFAULT;
+    line[len] = '\0';
+
+    command[0] = name[0] = '\0';
+    if (sscanf(line, "%s %s", command, name) != 2 || !valid_name(name))
+        return -EINVAL;
+
+    if (!strcasecmp(command, "create"))
+        ret = named_create(name);
+    else if (!strcasecmp(command, "delete"))
+        ret = named_delete(name);
+    else
+        ret = -EINVAL;
+
+    if (ret)
+        return ret;
+
+    *off += len;
+    return len;
+}
+
+/* Every named list and its number of items */
+static int modlist_control_show(struct seq_file *m, void *v) {
+    modlist_t *ml;
+
+    mutex_lock(&named_lock);
+    list_for_each_entry(ml, &named_lists, links) {
+        seq_printf(m, "%s %lu\n", ml->name, list_items(ml));
+    }
+    mutex_unlock(&named_lock);
+
+    return 0;
+}
+
+static int modlist_control_open(struct inode *inode, struct file *file) {
+    return single_open(file, modlist_control_show, NULL);
+}
+
+static const struct file_operations control_proc_entry_fops = {
+    .open = modlist_control_open,
+    .read = seq_read,
+    .llseek = seq_lseek,
+    .write = modlist_control_write,
+    .release = single_release,
+};
+
+int init_modlist_module( void ){
+
+#ifdef LIST_MODE
+    if (index_bits < INDEX_MIN_BITS || index_bits > INDEX_MAX_BITS) {
+        printk(KERN_INFO "Modlist: index_bits must be in [%d, %d]\n", INDEX_MIN_BITS, INDEX_MAX_BITS);
+        return -EINVAL;
+    }
+#endif
+
+    // init resources
+    default_list = modlist_create("");
+    if (default_list == NULL) {
+        printk(KERN_INFO "Modlist: Can't create the list\n");
+        return -ENOMEM;
+    }
+
+    proc_entry = proc_create_data("modlist", 0666, NULL, &proc_entry_fops, default_list);
+    if (proc_entry == NULL) {
+        printk(KERN_INFO "Modlist: Can't create /proc entry\n");
+        goto out_list;
+    }
+
+    pool_proc_entry = proc_create("modlist_pool", 0444, NULL, &pool_proc_entry_fops);
+    if (pool_proc_entry == NULL) {
+        printk(KERN_INFO "Modlist: Can't create /proc entry\n");
+        goto out_proc;
+    }
+
+    stats_proc_entry = proc_create("modlist_stats", 0444, NULL, &stats_proc_entry_fops);
+    if (stats_proc_entry == NULL) {
+        printk(KERN_INFO "Modlist: Can't create /proc entry\n");
+        goto out_pool_proc;
+    }
+
+#ifndef STRING_MODE
+    snap_proc_entry = proc_create_data("modlist_snap", 0444, NULL, &snap_proc_entry_fops, default_list);
+    if (snap_proc_entry == NULL) {
+        printk(KERN_INFO "Modlist: Can't create /proc entry\n");
+        goto out_stats_proc;
+    }
+#endif
+
+    lists_dir = proc_mkdir("modlists", NULL);
+    if (lists_dir == NULL) {
+        printk(KERN_INFO "Modlist: Can't create /proc entry\n");
+        goto out_snap_proc;
+    }
+
+    control_proc_entry = proc_create("control", 0666, lists_dir, &control_proc_entry_fops);
+    if (control_proc_entry == NULL) {
+        printk(KERN_INFO "Modlist: Can't create /proc entry\n");
+        goto out_lists_dir;
+    }
+
+    printk(KERN_INFO "Modlist: Module loaded.\n");
+    return 0;
+
+out_lists_dir:
+    remove_proc_entry("modlists", NULL);
+out_snap_proc:
+#ifndef STRING_MODE
+    remove_proc_entry("modlist_snap", NULL);
+out_stats_proc:
+#endif
+    remove_proc_entry("modlist_stats", NULL);
+out_pool_proc:
+    remove_proc_entry("modlist_pool", NULL);
+out_proc:
+    remove_proc_entry("modlist", NULL);
+out_list:
+    modlist_destroy(default_list);
+    return -ENOMEM;
+}
+
+void exit_modlist_module( void ){
+    modlist_t *ml, *temp;
+
+    // nobody can create more lists once control is gone
+    remove_proc_entry("control", lists_dir);
+    list_for_each_entry_safe(ml, temp, &named_lists, links) {
+        list_del(&ml->links);
+        named_unregister(ml);
+        modlist_destroy(ml);
+    }
+    remove_proc_entry("modlists", NULL);
+
+#ifndef STRING_MODE
+    remove_proc_entry("modlist_snap", NULL);
+#endif
+    remove_proc_entry("modlist_stats", NULL);
+    remove_proc_entry("modlist_pool", NULL);
+    remove_proc_entry("modlist", NULL);
+    modlist_destroy(default_list);
+
+    printk(KERN_INFO "Modlist: Module unloaded.\n");
+}
+
+module_init( init_modlist_module );
+module_exit( exit_modlist_module );
+
+
@@ -0,0 +1,144 @@
+/*
+ * Tracepoints of modlist, under events/modlist/ in tracefs:
+ *
+ *     echo 1 > /sys/kernel/debug/tracing/events/modlist/enable
+ *     cat /sys/kernel/debug/tracing/trace_pipe
+ *
+ * Every event records typed fields in binary, and is formatted only when
+ * the trace is read. While disabled, every call site is a patched out jump.
+ */
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM modlist
+
+#if !defined(_MODLIST_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _MODLIST_TRACE_H
+
+#include <linux/tracepoint.h>
+#include "modlist_ioctl.h"
+
+#ifdef STRING_MODE
+
+TRACE_EVENT(modlist_add,
+    TP_PROTO(const char *value),
+    TP_ARGS(value),
+    TP_STRUCT__entry(
+        __string(value, value)
+    ),
+    TP_fast_assign(
+        __assign_str(value, value);
+    ),
+    TP_printk("value=%s", __get_str(value))
+);
+
+TRACE_EVENT(modlist_remove,
+    TP_PROTO(const char *value, unsigned long count),
+    TP_ARGS(value, count),
+    TP_STRUCT__entry(
+        __string(value, value)
+        __field(unsigned long, count)
+    ),
+    TP_fast_assign(
+        __assign_str(value, value);
+        __entry->count = count;
+    ),
+    TP_printk("value=%s count=%lu", __get_str(value), __entry->count)
+);
+
+#else
+
+TRACE_EVENT(modlist_add,
+    TP_PROTO(int value),
+    TP_ARGS(value),
+    TP_STRUCT__entry(
+        __field(int, value)
+    ),
+    TP_fast_assign(
+        __entry->value = value;
+    ),
+    TP_printk("value=%d", __entry->value)
+);
+
+TRACE_EVENT(modlist_remove,
+    TP_PROTO(int value, unsigned long count),
+    TP_ARGS(value, count),
+    TP_STRUCT__entry(
+        __field(int, value)
+        __field(unsigned long, count)
+    ),
+    TP_fast_assign(
+        __entry->value = value;
+        __entry->count = count;
+    ),
+    TP_printk("value=%d count=%lu", __entry->value, __entry->count)
+);
+
+#endif
+
+/* count is the number of items when the list is emptied or sorted */
+DECLARE_EVENT_CLASS(modlist_whole,
+    TP_PROTO(unsigned long count),
+    TP_ARGS(count),
+    TP_STRUCT__entry(
+        __field(unsigned long, count)
+    ),
+    TP_fast_assign(
+        __entry->count = count;
+    ),
+    TP_printk("count=%lu", __entry->count)
+);
+
+DEFINE_EVENT(modlist_whole, modlist_cleanup,
+    TP_PROTO(unsigned long count),
+    TP_ARGS(count)
+);
+
+DEFINE_EVENT(modlist_whole, modlist_sort,
+    TP_PROTO(unsigned long count),
+    TP_ARGS(count)
+);
+
+/* cached is false when the read went through seq_file */
+TRACE_EVENT(modlist_read,
+    TP_PROTO(loff_t pos, ssize_t ret, bool cached),
+    TP_ARGS(pos, ret, cached),
+    TP_STRUCT__entry(
+        __field(loff_t, pos)
+        __field(ssize_t, ret)
+        __field(bool, cached)
+    ),
+    TP_fast_assign(
+        __entry->pos = pos;
+        __entry->ret = ret;
+        __entry->cached = cached;
+    ),
+    TP_printk("pos=%lld ret=%zd cached=%d",
+              __entry->pos, __entry->ret, __entry->cached)
+);
+
+TRACE_EVENT(modlist_bulk,
+    TP_PROTO(u32 cmd, u32 count),
+    TP_ARGS(cmd, count),
+    TP_STRUCT__entry(
+        __field(u32, cmd)
+        __field(u32, count)
+    ),
+    TP_fast_assign(
+        __entry->cmd = cmd;
+        __entry->count = count;
+    ),
+    TP_printk("cmd=%s count=%u",
+              __print_symbolic(__entry->cmd,
+                               { MODLIST_BULK_ADD, "add" },
+                               { MODLIST_BULK_REMOVE, "remove" },
+                               { MODLIST_BULK_REPLACE, "replace" }),
+              __entry->count)
+);
+
+#endif /* _MODLIST_TRACE_H */
+
+/* The header is not in include/trace/events, but next to modlist_main.c */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE modlist_trace
+#include <trace/define_trace.h>
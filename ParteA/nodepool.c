@@ -0,0 +1,229 @@
+#include "nodepool.h"
+#include <linux/slab.h> /* kmalloc()/kfree() */
+
+#ifndef NULL
+#define NULL 0
+#endif
+
+/* Every chunk starts with its link in the pool chunk list, nodes come next */
+typedef struct
+{
+    struct list_head links;
+}
+nodepool_chunk_t;
+
+#define CHUNK_HEADER_SIZE ALIGN(sizeof(nodepool_chunk_t), sizeof(void *))
+
+/* Create nodepool */
+nodepool_t* create_nodepool_t (unsigned int node_size)
+{
+    nodepool_t *pool = (nodepool_t *)kmalloc(sizeof(nodepool_t), GFP_KERNEL);
+    if (pool == NULL)
+    {
+        return NULL;
+    }
+    INIT_LIST_HEAD(&pool->chunks);
+    pool->free = NULL;
+    spin_lock_init(&pool->lock);
+
+    /* A free node keeps the free list link in its first word */
+    if (node_size < sizeof(void *))
+        node_size = sizeof(void *);
+    pool->node_size = ALIGN(node_size, sizeof(void *));
+    pool->nodes_per_chunk = (NODEPOOL_CHUNK_SIZE - CHUNK_HEADER_SIZE) / pool->node_size;
+    if (pool->nodes_per_chunk == 0)
+    {
+        kfree(pool);
+        return NULL;
+    }
+
+    pool->hits = 0;
+    pool->misses = 0;
+    pool->nr_chunks = 0;
+    pool->in_use = 0;
+    return pool;
+}
+
+/* Frees every chunk in "chunks" */
+static void free_chunks ( struct list_head *chunks )
+{
+    nodepool_chunk_t *pos, *temp;
+
+    list_for_each_entry_safe(pos, temp, chunks, links) {
+        list_del(&pos->links);
+        kfree(pos);
+    }
+}
+
+/* Release the pool and all its chunks */
+void destroy_nodepool_t ( nodepool_t* pool )
+{
+    free_chunks(&pool->chunks);
+    kfree(pool);
+}
+
+/* Adds a new chunk to the pool, pushing its nodes into the free list (pool locked) */
+static void carve_chunk ( nodepool_t* pool, nodepool_chunk_t* chunk )
+{
+    char *node = (char *)chunk + CHUNK_HEADER_SIZE;
+    int i;
+
+    list_add(&chunk->links, &pool->chunks);
+    pool->nr_chunks++;
+    pool->misses++;
+
+    /* Push the nodes backwards, so they are handed out in address order */
+    for (i = pool->nodes_per_chunk - 1; i >= 0; i--)
+    {
+        *(void **)(node + i * pool->node_size) = pool->free;
+        pool->free = node + i * pool->node_size;
+    }
+}
+
+/* Get a node from the free list, carving a new chunk if it is empty */
+static void* alloc_node ( nodepool_t* pool, gfp_t flags )
+{
+    nodepool_chunk_t *chunk;
+    void *ret;
+
+    spin_lock_bh(&pool->lock);
+    if (pool->free == NULL)
+    {
+        /* kmalloc may sleep, so the chunk is requested out of the lock */
+        spin_unlock_bh(&pool->lock);
+        chunk = (nodepool_chunk_t *)kmalloc(NODEPOOL_CHUNK_SIZE, flags);
+        if (chunk == NULL)
+        {
+            return NULL;
+        }
+        spin_lock_bh(&pool->lock);
+        carve_chunk(pool, chunk);
+    }
+    else
+    {
+        pool->hits++;
+    }
+
+    ret = pool->free;
+    pool->free = *(void **)ret;
+    pool->in_use++;
+    spin_unlock_bh(&pool->lock);
+
+    return ret;
+}
+
+void* alloc_nodepool_t ( nodepool_t* pool )
+{
+    return alloc_node(pool, GFP_KERNEL);
+}
+
+void* alloc_atomic_nodepool_t ( nodepool_t* pool )
+{
+    return alloc_node(pool, GFP_ATOMIC);
+}
+
+/* Get nr nodes at once, requesting all the missing chunks in a row */
+void* alloc_chain_nodepool_t ( nodepool_t* pool, unsigned long nr )
+{
+    nodepool_chunk_t *chunk, *temp;
+    LIST_HEAD(chunks);
+    unsigned long i, needed, carved = 0, popped = 0;
+    void *chain = NULL;
+    void *node;
+
+    spin_lock_bh(&pool->lock);
+    while (nr > 0)
+    {
+        if (pool->free == NULL)
+        {
+            needed = DIV_ROUND_UP(nr, pool->nodes_per_chunk);
+            spin_unlock_bh(&pool->lock);
+
+            for (i = 0; i < needed; i++)
+            {
+                chunk = (nodepool_chunk_t *)kmalloc(NODEPOOL_CHUNK_SIZE, GFP_KERNEL);
+                if (chunk == NULL)
+                {
+                    free_chunks(&chunks);
+                    free_chain_nodepool_t(pool, chain);
+                    return NULL;
+                }
+                list_add(&chunk->links, &chunks);
+            }
+
+            spin_lock_bh(&pool->lock);
+            list_for_each_entry_safe(chunk, temp, &chunks, links) {
+                carve_chunk(pool, chunk);
+            }
+            INIT_LIST_HEAD(&chunks);
+            carved += needed;
+        }
+
+        node = pool->free;
+        pool->free = *(void **)node;
+        *(void **)node = chain;
+        chain = node;
+        pool->in_use++;
+        popped++;
+        nr--;
+    }
+    /* the nodes taken from new chunks were counted as misses */
+    pool->hits += popped - carved;
+    spin_unlock_bh(&pool->lock);
+
+    return chain;
+}
+
+/* Give a node back to the free list */
+void free_nodepool_t ( nodepool_t* pool, void* node )
+{
+    spin_lock_bh(&pool->lock);
+    *(void **)node = pool->free;
+    pool->free = node;
+    pool->in_use--;
+    spin_unlock_bh(&pool->lock);
+}
+
+/* Give back a chain of nodes */
+void free_chain_nodepool_t ( nodepool_t* pool, void* chain )
+{
+    void *node, *last;
+    unsigned long nr;
+
+    if (chain == NULL)
+        return;
+
+    /* find the end out of the lock */
+    for (last = chain, nr = 1; *(void **)last != NULL; last = *(void **)last)
+        nr++;
+
+    spin_lock_bh(&pool->lock);
+    node = pool->free;
+    pool->free = chain;
+    *(void **)last = node;
+    pool->in_use -= nr;
+    spin_unlock_bh(&pool->lock);
+}
+
+/* Return the chunks to the kernel when the pool is not being used */
+void shrink_nodepool_t ( nodepool_t* pool )
+{
+    LIST_HEAD(chunks);
+
+    spin_lock_bh(&pool->lock);
+    if (pool->in_use == 0)
+    {
+        list_splice_init(&pool->chunks, &chunks);
+        pool->free = NULL;
+        pool->nr_chunks = 0;
+    }
+    spin_unlock_bh(&pool->lock);
+
+    free_chunks(&chunks);
+}
+
+/* Bytes held from the kernel allocator */
+unsigned long footprint_nodepool_t ( nodepool_t* pool )
+{
+    return pool->nr_chunks * NODEPOOL_CHUNK_SIZE;
+}
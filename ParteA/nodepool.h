@@ -0,0 +1,52 @@
+#ifndef NODEPOOL_H
+#define NODEPOOL_H
+
+#include <linux/list.h>
+#include <linux/spinlock.h>
+
+/* Size of every chunk requested to the kernel allocator */
+#define NODEPOOL_CHUNK_SIZE PAGE_SIZE
+
+typedef struct
+{
+    struct list_head chunks;        /* Chunks owned by the pool */
+    void *free;                     /* Free nodes, linked through their first word */
+    spinlock_t lock;                /* Taken with bh off, RCU callbacks free nodes */
+    unsigned int node_size;         /* Bytes reserved for every node */
+    unsigned int nodes_per_chunk;   /* Nodes carved from every chunk */
+    unsigned long hits;             /* Allocations served from the free list */
+    unsigned long misses;           /* Allocations that needed a new chunk */
+    unsigned long nr_chunks;        /* Chunks currently allocated */
+    unsigned long in_use;           /* Nodes currently handed out */
+}
+nodepool_t;
+
+/* Operations supported by nodepool_t */
+/* Creates a new pool of nodes of node_size bytes (takes care of allocating memory) */
+nodepool_t* create_nodepool_t (unsigned int node_size);
+
+/* Releases the pool and every chunk it owns, even if there are nodes in use */
+void destroy_nodepool_t ( nodepool_t* pool );
+
+/* Returns a node from the pool, or NULL if no memory is available */
+void* alloc_nodepool_t ( nodepool_t* pool );
+
+/* Same as alloc_nodepool_t, but it does not sleep (for callers holding a spinlock) */
+void* alloc_atomic_nodepool_t ( nodepool_t* pool );
+
+/* Returns a chain of nr nodes, linked through their first word and ended by NULL */
+void* alloc_chain_nodepool_t ( nodepool_t* pool, unsigned long nr );
+
+/* Gives a node back to the pool */
+void free_nodepool_t ( nodepool_t* pool, void* node );
+
+/* Gives a whole chain of nodes back to the pool */
+void free_chain_nodepool_t ( nodepool_t* pool, void* chain );
+
+/* Returns every chunk to the kernel if no node is in use */
+void shrink_nodepool_t ( nodepool_t* pool );
+
+/* Returns the number of bytes the pool holds from the kernel allocator */
+unsigned long footprint_nodepool_t ( nodepool_t* pool );
+
+#endif
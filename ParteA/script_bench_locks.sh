@@ -0,0 +1,43 @@
+#!/bin/bash
+
+###############################################################################
+#
+# script_bench_locks.sh
+#
+# Runs modlist_bench against the rwlock build and the TEST_NO_LOCK build of
+# modlist, so the cost of the lock and the failures without it can be
+# compared. Every argument is passed on to modlist_bench.
+#
+# Usage: script_bench_locks.sh [modlist_bench options]    (needs root to load modlist)
+#
+###############################################################################
+
+if ! make bench > /dev/null; then
+    echo " Can't build modlist_bench"
+    exit 1
+fi
+
+echo ""
+echo " Benchmarking modlist locking"
+echo " ================================================="
+
+for target in all modlist_nolock; do
+    make clean > /dev/null
+    if ! make $target > /dev/null; then
+        echo " Can't build $target"
+        exit 1
+    fi
+    make bench > /dev/null
+    if ! insmod modlist.ko; then
+        echo " Can't load modlist.ko"
+        exit 1
+    fi
+
+    echo ""
+    echo " $target:"
+    ./modlist_bench "$@"
+
+    rmmod modlist
+done
+
+make clean > /dev/null
@@ -0,0 +1,80 @@
+#!/bin/bash
+
+###############################################################################
+#
+# script_compare_locks.sh
+#
+# Runs the test_modlist.sh mix (20 writers, readers and 4 sorters) against the
+# rwlock build, the RCU_MODE build and the STAGED_ADD build of modlist, and
+# prints how long the writers take in each one. The readers do not sleep, so they keep the lock
+# (or the RCU read side) busy the whole time.
+#
+# Usage: script_compare_locks.sh [nr_readers]     (needs root to load modlist)
+#
+###############################################################################
+
+READERS=${1:-3}
+
+# Keep reading while the writers run
+reader() {
+    while [ -e /proc/modlist ] && [ ! -e test_logs/.done ]; do
+        cat /proc/modlist > /dev/null
+    done
+}
+
+run_mix() {
+    local writers=""
+
+    rm -rf test_logs
+    mkdir test_logs
+
+    for r_script in $(seq 1 $READERS); do
+        reader &
+    done
+    for s_script in {0..3}; do
+        bash script_sort.sh 0 3 &
+    done
+
+    local start=$(date +%s%N)
+    for w_script in {0..19}; do
+        bash script_writer.sh ${w_script} 20 1000 &
+        writers="$writers $!"
+    done
+    wait $writers
+    local end=$(date +%s%N)
+
+    touch test_logs/.done
+    wait
+
+    echo "sort" > /proc/modlist
+    cat /proc/modlist > test_logs/LAST_LECTURE.log
+    echo cleanup > /proc/modlist
+
+    echo -n "   writers: $(( (end - start) / 1000000 )) ms"
+    echo -n ", items: $(wc -l < test_logs/LAST_LECTURE.log)"
+    echo ", repeated: $(sort -n test_logs/LAST_LECTURE.log | uniq -d | wc -l)"
+}
+
+echo ""
+echo " Comparing modlist locking with $READERS readers"
+echo " ================================================="
+
+for target in all modlist_rcu modlist_staged; do
+    make clean > /dev/null
+    if ! make $target > /dev/null; then
+        echo " Can't build $target"
+        exit 1
+    fi
+    if ! insmod modlist.ko; then
+        echo " Can't load modlist.ko"
+        exit 1
+    fi
+
+    echo " $target:"
+    run_mix
+
+    rmmod modlist
+done
+
+rm -rf test_logs
+make clean > /dev/null
@@ -0,0 +1,32 @@
+#!/bin/bash
+
+###############################################################################
+#
+# test_common.sh
+#
+# Helpers of the modlist test scripts, that source it:
+#   check <name> <got> <expected>   counts the check as failed if they differ
+#   summary                         prints the result, exits 1 if any failed
+#
+###############################################################################
+
+ERRORS=0
+
+check() {
+    if [ "$2" != "$3" ]; then
+        echo " FAILED: $1 (expected $3, got $2)"
+        ERRORS=$(( ERRORS + 1 ))
+    else
+        echo " ok: $1"
+    fi
+}
+
+summary() {
+    echo ""
+    if [ $ERRORS -eq 0 ]; then
+        echo " All the checks passed"
+    else
+        echo " $ERRORS checks failed"
+        exit 1
+    fi
+}
@@ -55,3 +55,4 @@ echo " To check if the result is correct, you can read test_logs/LAST_LECTURE.lo
 echo " There should not be any repeated number."
 echo " Also, all the other files are the lectures realized by the concurrent 'read scripts'"
 echo " The same condition of zero-repeated-numbers applies."
+echo " make bench && ./modlist_bench runs a similar mix with threads, and checks all of it by itself."
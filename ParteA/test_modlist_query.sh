@@ -0,0 +1,56 @@
+#!/bin/bash
+
+###############################################################################
+#
+# test_modlist_query.sh
+#
+# Checks the query commands of modlist. The answers are read back from the
+# same open file the queries were written to. A STRING_MODE build (no sum
+# command) only runs the checks of min and max over strings
+#
+###############################################################################
+
+source "$(dirname "$0")/test_common.sh"
+
+# query <commands>: runs them on a new open file and prints the answers in a line
+query() {
+    exec 3<> /proc/modlist
+    printf "$1" >&3
+    cat <&3 | tr '\n' ' '
+    exec 3>&-
+}
+
+echo ""
+echo " Testing modlist queries"
+echo " ================================================="
+
+echo cleanup > /proc/modlist
+if [ -z "$(query 'sum\n' 2> /dev/null)" ]; then
+    # the nodes of a removed max are freed before min and max are asked again
+    printf "add Foo\nadd bar\nadd FOO\nadd baz\nremove foo\n" > /proc/modlist
+    check "string min and max after remove" "$(query 'min\nmax\ncount\n')" "bar baz 2 "
+    printf "remove baz\nremove bar\n" > /proc/modlist
+    check "string empty after remove" "$(query 'count\nmin\nmax\n')" "0   "
+    echo cleanup > /proc/modlist
+else
+    check "empty list" "$(query 'count\nmin\nmax\nsum\n')" "0   0 "
+
+    printf "add 5\nadd -3\nadd 9\nadd 5\nadd 5\n" > /proc/modlist
+    check "count" "$(query 'count\n')" "5 "
+    check "contains" "$(query 'contains 9\ncontains 4\n')" "1 0 "
+    check "occurrences" "$(query 'occurrences 5\noccurrences 4\n')" "3 0 "
+    check "min and max" "$(query 'min\nmax\n')" "-3 9 "
+    check "sum" "$(query 'sum\n')" "21 "
+
+    # removing min and max makes them be found again
+    printf "remove -3\nremove 9\n" > /proc/modlist
+    check "after remove" "$(query 'count\nmin\nmax\nsum\n')" "3 5 5 15 "
+
+    # answered in order with the changes of the same write
+    check "mixed with changes" "$(query 'add 100\nmax\nremove 100\nmax\n')" "100 5 "
+
+    echo cleanup > /proc/modlist
+    check "after cleanup" "$(query 'count\nsum\n')" "0 0 "
+fi
+
+summary
@@ -0,0 +1,44 @@
+#!/bin/bash
+
+###############################################################################
+#
+# test_modlist_rbtree.sh
+#
+# Checks a modlist built with RBTREE_MODE (make modlist_rbtree): the items
+# come out sorted, duplicates are kept and remove drops all of them
+#
+###############################################################################
+
+ITEMS=${1:-100000}
+source "$(dirname "$0")/test_common.sh"
+
+echo ""
+echo " Testing modlist rbtree storage"
+echo " ================================================="
+
+echo cleanup > /proc/modlist
+
+# random values, many of them repeated
+for (( i = 0; i < ITEMS; i++ )); do
+    echo "add $(( RANDOM % 1000 - 500 ))"
+done > /tmp/modlist_values.txt
+cat /tmp/modlist_values.txt > /proc/modlist
+check "item count" "$(wc -l < /proc/modlist)" "$ITEMS"
+check "sorted" "$(cat /proc/modlist | md5sum)" "$(cut -d' ' -f2 /tmp/modlist_values.txt | sort -n | md5sum)"
+
+# sort does not change anything
+before=$(cat /proc/modlist | md5sum)
+echo sort > /proc/modlist
+check "sort" "$(cat /proc/modlist | md5sum)" "$before"
+
+printf "cleanup\nadd 5\nadd 3\nadd 5\nadd -1\nadd 3\nadd 5\n" > /proc/modlist
+check "duplicates" "$(cat /proc/modlist | tr '\n' ' ')" "-1 3 3 5 5 5 "
+
+echo "remove 5" > /proc/modlist
+check "remove" "$(cat /proc/modlist | tr '\n' ' ')" "-1 3 3 "
+
+echo cleanup > /proc/modlist
+check "cleanup" "$(cat /proc/modlist | wc -l)" "0"
+rm -f /tmp/modlist_values.txt
+
+summary
@@ -0,0 +1,51 @@
+#!/bin/bash
+
+###############################################################################
+#
+# test_modlist_write.sh
+#
+# Checks the multi-command writes of modlist: bulk loads from a file, lines
+# split between two writes and a last line without '\n'
+#
+###############################################################################
+
+ITEMS=${1:-100000}
+source "$(dirname "$0")/test_common.sh"
+
+echo ""
+echo " Testing modlist writes"
+echo " ================================================="
+
+echo cleanup > /proc/modlist
+
+# bulk load, one add per line, in a single cat
+seq 1 $ITEMS | sed 's/^/add /' > /tmp/modlist_values.txt
+start=$(date +%s%N)
+cat /tmp/modlist_values.txt > /proc/modlist
+end=$(date +%s%N)
+echo " loaded $ITEMS items in $(( (end - start) / 1000000 )) ms"
+check "bulk load" "$(wc -l < /proc/modlist)" "$ITEMS"
+check "bulk load order" "$(cat /proc/modlist | md5sum)" "$(seq 1 $ITEMS | md5sum)"
+
+# commands mixed in the same write
+printf "cleanup\nadd 3\nadd 1\nadd 2\nremove 1\nsort\n" > /proc/modlist
+check "mixed commands" "$(cat /proc/modlist | tr '\n' ' ')" "2 3 "
+
+# a line split between two writes on the same open file
+{ printf "ad"; sleep 0.1; printf "d 7\nadd 8\n"; } > /proc/modlist
+check "split line" "$(cat /proc/modlist | tr '\n' ' ')" "2 3 7 8 "
+
+# the last line does not need '\n'
+echo -n "remove 7" > /proc/modlist
+check "last line without newline" "$(cat /proc/modlist | tr '\n' ' ')" "2 3 8 "
+
+# a line too long in the middle: the lines before it are run, the write stops there
+long=$(printf 'x%.0s' $(seq 1 100))
+printf "cleanup\nadd 1\n%s\nadd 3\n" "$long" > /proc/modlist 2> /dev/null
+check "bad line fails the write" "$?" "1"
+check "lines before a bad line" "$(cat /proc/modlist | tr '\n' ' ')" "1 "
+
+echo cleanup > /proc/modlist
+rm -f /tmp/modlist_values.txt
+
+summary
@@ -0,0 +1,58 @@
+#!/bin/bash
+
+###############################################################################
+#
+# test_modlists.sh
+#
+# Checks the named lists of /proc/modlists: create, independent contents,
+# concurrent writers on different lists and delete
+#
+###############################################################################
+
+ITEMS=${1:-10000}
+source "$(dirname "$0")/test_common.sh"
+
+echo ""
+echo " Testing named modlists"
+echo " ================================================="
+
+echo cleanup > /proc/modlist
+echo create a > /proc/modlists/control
+echo create b > /proc/modlists/control
+check "create" "$(ls /proc/modlists | grep -c '^[ab]$')" "2"
+
+echo create a > /proc/modlists/control 2> /dev/null
+check "create twice fails" "$?" "1"
+echo create ../x > /proc/modlists/control 2> /dev/null
+check "bad name fails" "$?" "1"
+
+# every list keeps its own content
+echo add 1 > /proc/modlist
+echo add 2 > /proc/modlists/a
+echo add 3 > /proc/modlists/b
+check "default list" "$(cat /proc/modlist | tr '\n' ' ')" "1 "
+check "list a" "$(cat /proc/modlists/a | tr '\n' ' ')" "2 "
+check "list b" "$(cat /proc/modlists/b | tr '\n' ' ')" "3 "
+
+# one writer on every list at the same time
+printf "cleanup\n" > /proc/modlists/a
+printf "cleanup\n" > /proc/modlists/b
+seq 1 $ITEMS | sed 's/^/add /' > /tmp/modlists_values.txt
+cat /tmp/modlists_values.txt > /proc/modlists/a &
+cat /tmp/modlists_values.txt > /proc/modlists/b &
+wait
+check "concurrent writers a" "$(wc -l < /proc/modlists/a)" "$ITEMS"
+check "concurrent writers b" "$(wc -l < /proc/modlists/b)" "$ITEMS"
+check "control listing" "$(grep -c " $ITEMS\$" /proc/modlists/control)" "2"
+
+echo delete a > /proc/modlists/control
+echo delete b > /proc/modlists/control
+check "delete" "$(ls /proc/modlists | grep -c '^[ab]$')" "0"
+echo delete a > /proc/modlists/control 2> /dev/null
+check "delete twice fails" "$?" "1"
+check "default list kept" "$(cat /proc/modlist | tr '\n' ' ')" "1 "
+
+echo cleanup > /proc/modlist
+rm -f /tmp/modlists_values.txt
+
+summary
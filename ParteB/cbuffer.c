@@ -14,31 +14,41 @@
 /* Create cbuffer */
 cbuffer_t* create_cbuffer_t (unsigned int max_size)
 {
+	unsigned int data_size=1;
+	cbuffer_t *cbuffer;
+
+	/* The indices run free, so the data must be a power of 2 */
+	if (max_size > (1U << 31))
+		return NULL;
+	while (data_size < max_size)
+		data_size <<= 1;
+
 #ifdef __KERNEL__ 
-	cbuffer_t *cbuffer= (cbuffer_t *)vmalloc(sizeof(cbuffer_t));
+	cbuffer= (cbuffer_t *)vmalloc(sizeof(cbuffer_t));
 #else
-	cbuffer_t *cbuffer= (cbuffer_t *)malloc(sizeof(cbuffer_t));
+	cbuffer= (cbuffer_t *)aligned_alloc(__alignof__(cbuffer_t), sizeof(cbuffer_t));
 #endif
 	if (cbuffer == NULL)
 	{
 	    return NULL;
 	}
-	cbuffer->size=0;
 	cbuffer->head=0;
+	cbuffer->tail=0;
+	cbuffer->mask=data_size-1;
 	cbuffer->max_size=max_size;
 
 	/* Stores bytes */
 #ifdef __KERNEL__ 
-	cbuffer->data=vmalloc(max_size);
+	cbuffer->data=vmalloc(data_size);
 #else
-	cbuffer->data=malloc(max_size);
+	cbuffer->data=malloc(data_size);
 #endif
 	if ( cbuffer->data == NULL)
 	{
 #ifdef __KERNEL__ 
-		vfree(cbuffer->data);
+		vfree(cbuffer);
 #else
-		free(cbuffer->data);
+		free(cbuffer);
 #endif
 		return NULL;
 	}
@@ -48,8 +58,8 @@ cbuffer_t* create_cbuffer_t (unsigned int max_size)
 /* Release memory from circular buffer  */
 void destroy_cbuffer_t ( cbuffer_t* cbuffer )
 {
-    cbuffer->size=0;
     cbuffer->head=0;
+    cbuffer->tail=0;
     cbuffer->max_size=0;
 #ifdef __KERNEL__ 
     vfree(cbuffer->data);
@@ -60,124 +70,132 @@ void destroy_cbuffer_t ( cbuffer_t* cbuffer )
 #endif
 }
 
+/*
+ * Current size. tail is read before head: whichever side calls, its own index
+ * does not move, and the other one can only make the result smaller (the
+ * reader) or bigger (the writer) than it was, never out of [0 .. max_size]
+ */
+static inline unsigned int used_cbuffer_t ( cbuffer_t* cbuffer )
+{
+	unsigned int tail=smp_load_acquire(&cbuffer->tail);
+
+	return tail-smp_load_acquire(&cbuffer->head);
+}
+
+/* Splits nr_items from index pos in at most two contiguous segments */
+static int segments_cbuffer_t ( cbuffer_t* cbuffer, unsigned int pos, unsigned int nr_items, char* seg[2], int len[2] )
+{
+	unsigned int first;
+
+	if (nr_items==0)
+		return 0;
+
+	pos&=cbuffer->mask;
+	first=cbuffer->mask+1-pos;
+	seg[0]=&cbuffer->data[pos];
+	if (nr_items<=first)
+	{
+		len[0]=nr_items;
+		return 1;
+	}
+	len[0]=first;
+	seg[1]=cbuffer->data;
+	len[1]=nr_items-first;
+	return 2;
+}
+
+/* Copies nr_items from items to the buffer, from index pos */
+static void copy_in_cbuffer_t ( cbuffer_t* cbuffer, unsigned int pos, const char* items, unsigned int nr_items )
+{
+	char* seg[2];
+	int len[2];
+	int i, nr_segs=segments_cbuffer_t(cbuffer, pos, nr_items, seg, len);
+
+	for (i=0; i<nr_segs; i++)
+	{
+		memcpy(seg[i],items,len[i]);
+		items+=len[i];
+	}
+}
+
+/* Copies nr_items from the buffer to items, from index pos */
+static void copy_out_cbuffer_t ( cbuffer_t* cbuffer, unsigned int pos, char* items, unsigned int nr_items )
+{
+	char* seg[2];
+	int len[2];
+	int i, nr_segs=segments_cbuffer_t(cbuffer, pos, nr_items, seg, len);
+
+	for (i=0; i<nr_segs; i++)
+	{
+		memcpy(items,seg[i],len[i]);
+		items+=len[i];
+	}
+}
+
 /* Returns the number of elements in the buffer */
 int size_cbuffer_t ( cbuffer_t* cbuffer )
 {
-	return cbuffer->size ;
+	return used_cbuffer_t(cbuffer);
 }
 
 int nr_gaps_cbuffer_t ( cbuffer_t* cbuffer )
 {
-	return cbuffer->max_size-cbuffer->size;
+	return cbuffer->max_size-used_cbuffer_t(cbuffer);
 }
 
 /* Return a non-zero value when buffer is full */
 int is_full_cbuffer_t ( cbuffer_t* cbuffer )
 {
-	return ( cbuffer->size == cbuffer->max_size ) ;
+	return ( used_cbuffer_t(cbuffer) == cbuffer->max_size ) ;
 }
 
 /* Return a non-zero value when buffer is empty */
 int is_empty_cbuffer_t ( cbuffer_t* cbuffer )
 {
-	return ( cbuffer->size == 0 ) ;
+	return ( used_cbuffer_t(cbuffer) == 0 ) ;
 }
 
 
 /* Inserts an item at the end of the buffer */
 void insert_cbuffer_t ( cbuffer_t* cbuffer, char new_item )
 {
-	unsigned int pos=0;
-	/* The buffer is full */
-	if ( cbuffer->size == cbuffer->max_size )
-	{
-		/* Overwriting head position */
-		cbuffer->data[cbuffer->head]=new_item;
-		/* Now head position must be the next one*/
-		if ( cbuffer->size !=0 )
-			cbuffer->head= ( cbuffer->head+1 ) % cbuffer->max_size;
-		/* Size remains constant*/
-	}
-	else
-	{
-		if ( cbuffer->max_size!=0 )
-			pos= ( cbuffer->head+cbuffer->size ) % cbuffer->max_size;
-		cbuffer->data[pos]=new_item;
-		cbuffer->size++;
-	}
+	if ( cbuffer->max_size == 0 )
+		return;
+
+	/* The buffer is full: the head position is overwritten, the next one is the head now */
+	if ( used_cbuffer_t(cbuffer) == cbuffer->max_size )
+		smp_store_release(&cbuffer->head, cbuffer->head+1);
+
+	cbuffer->data[cbuffer->tail & cbuffer->mask]=new_item;
+	smp_store_release(&cbuffer->tail, cbuffer->tail+1);
 }
 
 /* Inserts nr_items into the buffer */
 void insert_items_cbuffer_t ( cbuffer_t* cbuffer, const char* items, int nr_items)
 {
-	int nr_items_left=nr_items;
-	int items_copied;
-	int nr_gaps=cbuffer->max_size-cbuffer->size;
-	int whead=(cbuffer->head+cbuffer->size)%cbuffer->max_size;
+	unsigned int nr_gaps=cbuffer->max_size-used_cbuffer_t(cbuffer);
 	
 	/* Restriction: nr_items can't be greater than the max buffer size) */
 	if (nr_items>cbuffer->max_size)
 		return;
 	
-	/* Check if we can't store all items at the end of the buffer */
-	if (whead+nr_items_left > cbuffer->max_size)
-	{
-		items_copied=cbuffer->max_size-whead;
-		memcpy(&cbuffer->data[whead],items,items_copied);
-		nr_items_left-=items_copied;
-		items+=items_copied; //Move the pointer forward
-		whead=0;		
-	}
-	
-	/* If we still have to copy elements -> do it*/
-	if (nr_items_left)
-	{
-		memcpy(&cbuffer->data[whead],items,nr_items_left);
-		whead+=nr_items_left;
-	}
-	
-	/* Update size and head */
-	if (nr_gaps>=nr_items)
-	{
-		cbuffer->size+=nr_items;
-	}else
-	{
-		cbuffer->size=cbuffer->max_size;
-		/* head moves in the event we overwrite stuff */
-		cbuffer->head=(cbuffer->head+(nr_items-nr_gaps))% cbuffer->max_size;
-	}
+	copy_in_cbuffer_t(cbuffer, cbuffer->tail, items, nr_items);
+
+	/* head moves in the event we overwrite stuff */
+	if (nr_gaps<nr_items)
+		smp_store_release(&cbuffer->head, cbuffer->head+(nr_items-nr_gaps));
+	smp_store_release(&cbuffer->tail, cbuffer->tail+nr_items);
 }
 
 /* Removes nr_items from the buffer and returns a copy of them */
 void remove_items_cbuffer_t ( cbuffer_t* cbuffer, char* items, int nr_items)
 {
-	int nr_items_left=nr_items;
-	int items_copied;
-	
 	/* Restriction: nr_items can't be greater than the buffer size (Ignore)) */
-	if (nr_items>cbuffer->size)
+	if (nr_items>used_cbuffer_t(cbuffer))
 		return;	
 	
-	/* Check if we can't store all items at the end of the buffer */
-	if (cbuffer->head+nr_items_left > cbuffer->max_size)
-	{
-		items_copied=cbuffer->max_size-cbuffer->head;
-		memcpy(items,&cbuffer->data[cbuffer->head],items_copied);
-		nr_items_left-=items_copied;
-		items+=items_copied; //Move the pointer forward
-		cbuffer->head=0;		
-	}
-	
-	
-	/* If we still have to copy elements -> do it*/
-	if (nr_items_left)
-	{
-		memcpy(items,&cbuffer->data[cbuffer->head],nr_items_left);
-		cbuffer->head+=nr_items_left;
-	}
-	
-	/* Update size */
-	cbuffer->size-=nr_items;
+	copy_out_cbuffer_t(cbuffer, cbuffer->head, items, nr_items);
+	smp_store_release(&cbuffer->head, cbuffer->head+nr_items);
 }
 
 
@@ -186,11 +204,10 @@ char remove_cbuffer_t ( cbuffer_t* cbuffer)
 {
 	char ret='\0';
 	
-	if ( cbuffer->size !=0 )
+	if ( used_cbuffer_t(cbuffer) !=0 )
 	{
-		ret=cbuffer->data[cbuffer->head];	
-		cbuffer->head= ( cbuffer->head+1 ) % cbuffer->max_size;
-		cbuffer->size--;
+		ret=cbuffer->data[cbuffer->head & cbuffer->mask];
+		smp_store_release(&cbuffer->head, cbuffer->head+1);
 	}
 	
 	return ret;
@@ -198,19 +215,46 @@ char remove_cbuffer_t ( cbuffer_t* cbuffer)
 
 /* Removes all items in the buffer */
 void clear_cbuffer_t (cbuffer_t* cbuffer) { 
-	cbuffer->size = 0; 
-	cbuffer->head = 0;
+	smp_store_release(&cbuffer->head, smp_load_acquire(&cbuffer->tail));
 }
 
 /* Returns the first element in the buffer */
 char* head_cbuffer_t ( cbuffer_t* cbuffer )
 {
-	if ( cbuffer->size !=0 )
-		return &cbuffer->data[cbuffer->head];
+	if ( used_cbuffer_t(cbuffer) !=0 )
+		return &cbuffer->data[cbuffer->head & cbuffer->mask];
 	else{
 		return NULL;
 	}
 }
 
+/* Returns the used bytes as at most two contiguous segments */
+int used_segments_cbuffer_t ( cbuffer_t* cbuffer, char* seg[2], int len[2] )
+{
+	return segments_cbuffer_t(cbuffer, cbuffer->head, used_cbuffer_t(cbuffer), seg, len);
+}
 
+/* Returns the free bytes as at most two contiguous segments */
+int free_segments_cbuffer_t ( cbuffer_t* cbuffer, char* seg[2], int len[2] )
+{
+	return segments_cbuffer_t(cbuffer, cbuffer->tail,
+	                          cbuffer->max_size-used_cbuffer_t(cbuffer), seg, len);
+}
 
+/* Inserts the nr_items first bytes of the free segments */
+void commit_items_cbuffer_t ( cbuffer_t* cbuffer, int nr_items )
+{
+	/* Restriction: nr_items can't be greater than the free gaps (Ignore) */
+	if (nr_items>cbuffer->max_size-used_cbuffer_t(cbuffer))
+		return;
+	smp_store_release(&cbuffer->tail, cbuffer->tail+nr_items);
+}
+
+/* Removes the nr_items first elements in the buffer, without copying them */
+void discard_items_cbuffer_t ( cbuffer_t* cbuffer, int nr_items )
+{
+	/* Restriction: nr_items can't be greater than the buffer size (Ignore) */
+	if (nr_items>used_cbuffer_t(cbuffer) || nr_items==0)
+		return;
+	smp_store_release(&cbuffer->head, cbuffer->head+nr_items);
+}
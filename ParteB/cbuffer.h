@@ -1,13 +1,35 @@
 #ifndef CBUFFER_H
 #define CBUFFER_H
 
+#ifdef __KERNEL__
+#include <linux/cache.h> /* ____cacheline_aligned_in_smp */
+#include <asm/barrier.h> /* smp_load_acquire()/smp_store_release() */
+#else
+#ifndef smp_load_acquire
+#define smp_load_acquire(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define smp_store_release(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+#endif
+#ifndef ____cacheline_aligned_in_smp
+#define ____cacheline_aligned_in_smp __attribute__((__aligned__(64)))
+#endif
+#endif
 
+/*
+ * head and tail run free, wrapping around UINT_MAX: the element of index i is
+ * data[i & mask] and size is tail-head. A reader and a writer may use the
+ * buffer at the same time without a lock, as the reader only moves head and
+ * the writer only moves tail, each in its own cacheline, and every side reads
+ * the index of the other with acquire and moves its own with release.
+ * Except insert_cbuffer_t and insert_items_cbuffer_t on a full buffer, which
+ * overwrite the first elements and so move head too.
+ */
 typedef struct
 {
-    char* data;			/* raw byte vector */
-	unsigned int head;		/* Index of the first element // head in [0 .. max_size-1] */
-	unsigned int size;		/* Current Buffer size // size in [0 .. max_size] */
+    char* data;			/* raw byte vector of mask+1 bytes */
+	unsigned int mask;		/* A power of 2 minus 1, so that max_size <= mask+1 */
 	unsigned int max_size;  	/* Buffer max capacity */
+	unsigned int head ____cacheline_aligned_in_smp;	/* Index of the first element */
+	unsigned int tail ____cacheline_aligned_in_smp;	/* Index past the last element // size = tail-head in [0 .. max_size] */
 }
 cbuffer_t;
 
@@ -48,4 +70,20 @@ void clear_cbuffer_t (cbuffer_t* cbuffer);
 /* Returns a pointer to the first element in the buffer */
 char* head_cbuffer_t ( cbuffer_t* cbuffer );
 
+/*
+ * Zero copy access. The used (free) bytes of the buffer, in order, are at most
+ * two contiguous segments: seg[i] points to len[i] bytes. Returns how many
+ * there are. Reading the used segments does not remove the items, nor writing
+ * the free ones inserts them: discard_items_cbuffer_t and commit_items_cbuffer_t
+ * do it once the data is copied.
+ */
+int used_segments_cbuffer_t ( cbuffer_t* cbuffer, char* seg[2], int len[2] );
+int free_segments_cbuffer_t ( cbuffer_t* cbuffer, char* seg[2], int len[2] );
+
+/* Inserts the nr_items first bytes of the free segments */
+void commit_items_cbuffer_t ( cbuffer_t* cbuffer, int nr_items );
+
+/* Removes the nr_items first elements in the buffer, without copying them */
+void discard_items_cbuffer_t ( cbuffer_t* cbuffer, int nr_items );
+
 #endif
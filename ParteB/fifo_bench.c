@@ -0,0 +1,289 @@
+/*=====================================================================================
+    PROGRAM: fifo_bench
+
+    DESCRIPTION:
+        Multithreaded benchmark and correctness check of /proc/fifoproc.
+        Producer threads write numbered records to the fifo while consumer
+        threads read them, then every record is checked to have arrived once,
+        whole and, with a single consumer, in the order it was written. It
+        reports the throughput and the context switches per MB moved.
+        Records longer than PIPE_BUF are not written atomically, so they need
+        a single producer and consumer.
+
+    USAGE:
+        make bench      (./fifo_bench, against the loaded module)
+        make ubench     (./fifo_ubench, the module built in, see ucompat/)
+        ./fifo_bench [-p producers] [-c consumers] [-n records] [-s size]
+        UCOMPAT_PARAMS="buffer_size=<bytes>" ./fifo_ubench ...
+
+        -p  producer threads (2)
+        -c  consumer threads (1)
+        -n  records written by every producer (100000)
+        -s  bytes of a record, at least 8 (16)
+=====================================================================================
+*/
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <limits.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#ifdef UCOMPAT
+/* The module is part of this program, its /proc entries are reached through ucompat */
+#include "ucompat_user.h"
+#define file_open       ucompat_open
+#define file_read       ucompat_read
+#define file_write      ucompat_write
+#define file_close      ucompat_close
+#else
+#define file_open       open
+#define file_read       read
+#define file_write      write
+#define file_close      close
+#endif
+
+#define FIFO_PATH       "/proc/fifoproc"
+#define READ_CHUNK      65536
+
+/* Head of every record, repeated at its end if it fits. The rest is padding */
+typedef struct {
+    uint32_t producer;
+    uint32_t seq;
+}record_t;
+
+typedef struct {
+    pthread_t tid;
+    int index;
+    unsigned long records;      // written or read
+    unsigned long bad;          // consumers: torn, unknown, repeated or out of order records
+    int failed;                 // could not open, read or write
+}worker_t;
+
+/* Options */
+static int nr_producers = 2, nr_consumers = 1;
+static long nr_records = 100000;
+static int record_size = 16;
+
+/* Times every record was read, by producer and sequence number */
+static unsigned char *seen;
+
+/* Every producer waits for the rest before its first write, so that a
+ * consumer can not see the fifo without producers before the last one opens */
+static pthread_barrier_t producers_open;
+
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Voluntary and involuntary context switches of every thread so far */
+static long context_switches(void) {
+    struct rusage ru;
+
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_nvcsw + ru.ru_nivcsw;
+}
+
+static void *producer(void *arg) {
+    worker_t *w = arg;
+    char *buf = calloc(1, record_size);
+    record_t rec;
+    int fd;
+    long i;
+
+    fd = file_open(FIFO_PATH, O_WRONLY);
+    pthread_barrier_wait(&producers_open);
+    if (fd < 0 || buf == NULL) {
+        w->failed = 1;
+        free(buf);
+        return NULL;
+    }
+
+    rec.producer = w->index;
+    for (i = 0; i < nr_records; i++) {
+        rec.seq = i;
+        memcpy(buf, &rec, sizeof(rec));
+        memcpy(buf + record_size - sizeof(rec), &rec, sizeof(rec));
+        if (file_write(fd, buf, record_size) != record_size) {
+            w->failed = 1;
+            break;
+        }
+        w->records++;
+    }
+
+    file_close(fd);
+    free(buf);
+    return NULL;
+}
+
+/* Checks a whole record read by w */
+static void check_record(worker_t *w, const char *buf, uint32_t *next_seq) {
+    record_t rec, tail;
+
+    memcpy(&rec, buf, sizeof(rec));
+    memcpy(&tail, buf + record_size - sizeof(tail), sizeof(tail));
+    w->records++;
+
+    if (memcmp(&rec, &tail, sizeof(rec)) || rec.producer >= nr_producers || rec.seq >= nr_records) {
+        w->bad++;
+        return;
+    }
+    if (__atomic_fetch_add(&seen[rec.producer * nr_records + rec.seq], 1, __ATOMIC_RELAXED))
+        w->bad++;
+    // the records of a producer keep their order for a single consumer
+    if (nr_consumers == 1 && rec.seq != next_seq[rec.producer])
+        w->bad++;
+    next_seq[rec.producer] = rec.seq + 1;
+}
+
+/*
+ * A read returns what there is, so a record may come in pieces. With several
+ * consumers every read asks for whole records, and as the records are written
+ * atomically, it gets whole records.
+ */
+static void *consumer(void *arg) {
+    worker_t *w = arg;
+    size_t chunk = record_size > READ_CHUNK ? record_size : READ_CHUNK / record_size * record_size;
+    size_t have = 0, pos;
+    uint32_t *next_seq;
+    char *buf;
+    ssize_t n;
+    int fd;
+
+    next_seq = calloc(nr_producers, sizeof(uint32_t));
+    buf = malloc(chunk);
+    fd = file_open(FIFO_PATH, O_RDONLY);
+    if (fd < 0 || next_seq == NULL || buf == NULL) {
+        w->failed = 1;
+        goto out;
+    }
+
+    // read returns 0 once there are no producers and the fifo is empty
+    while ((n = file_read(fd, buf + have, chunk - have)) != 0) {
+        if (n < 0) {
+            w->failed = 1;
+            break;
+        }
+        have += n;
+        for (pos = 0; pos + record_size <= have; pos += record_size)
+            check_record(w, buf + pos, next_seq);
+        have -= pos;
+        memmove(buf, buf + pos, have);
+    }
+    // a piece of a record left
+    if (have)
+        w->bad++;
+
+    file_close(fd);
+out:
+    free(buf);
+    free(next_seq);
+    return NULL;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [-p producers] [-c consumers] [-n records] [-s size]\n", name);
+    exit(2);
+}
+
+int main(int argc, char *argv[]) {
+    worker_t *workers;
+    int nr, i, opt, errors = 0;
+    unsigned long written = 0, read = 0, bad = 0, missing = 0;
+    uint64_t start, end;
+    double seconds, mb;
+    long k, csw;
+
+    while ((opt = getopt(argc, argv, "p:c:n:s:")) != -1) {
+        switch (opt) {
+        case 'p': nr_producers = atoi(optarg); break;
+        case 'c': nr_consumers = atoi(optarg); break;
+        case 'n': nr_records = atol(optarg); break;
+        case 's': record_size = atoi(optarg); break;
+        default: usage(argv[0]);
+        }
+    }
+    if (nr_producers < 1 || nr_consumers < 1 || nr_records < 1 ||
+        record_size < (int)sizeof(record_t))
+        usage(argv[0]);
+    if (record_size > PIPE_BUF && (nr_producers > 1 || nr_consumers > 1)) {
+        fprintf(stderr, " Records longer than %d bytes need -p 1 -c 1\n", PIPE_BUF);
+        return 2;
+    }
+
+#ifdef UCOMPAT
+    if (ucompat_load()) {
+        fprintf(stderr, " Can't load the module: %s\n", strerror(errno));
+        return 2;
+    }
+#endif
+
+    nr = nr_producers + nr_consumers;
+    workers = calloc(nr, sizeof(worker_t));
+    seen = calloc(nr_producers * nr_records, 1);
+    if (workers == NULL || seen == NULL)
+        return 2;
+    pthread_barrier_init(&producers_open, NULL, nr_producers);
+
+    printf(" %s: %d producers x %ld records of %d bytes, %d consumers\n",
+           FIFO_PATH, nr_producers, nr_records, record_size, nr_consumers);
+
+    csw = context_switches();
+    start = now_ns();
+    for (i = 0; i < nr; i++) {
+        workers[i].index = i < nr_producers ? i : i - nr_producers;
+        if (pthread_create(&workers[i].tid, NULL, i < nr_producers ? producer : consumer, &workers[i])) {
+            perror("pthread_create");
+            return 2;
+        }
+    }
+    for (i = 0; i < nr; i++)
+        pthread_join(workers[i].tid, NULL);
+    end = now_ns();
+    csw = context_switches() - csw;
+    seconds = (end - start) / 1e9;
+
+    for (i = 0; i < nr; i++) {
+        if (workers[i].failed) {
+            printf("   %s thread %d could not open, write or read %s\n",
+                   i < nr_producers ? "producer" : "consumer", workers[i].index, FIFO_PATH);
+            errors++;
+        }
+        if (i < nr_producers)
+            written += workers[i].records;
+        else
+            read += workers[i].records;
+        bad += workers[i].bad;
+    }
+    for (k = 0; k < nr_producers * nr_records; k++)
+        missing += (seen[k] == 0);
+
+    mb = (double)read * record_size / 1e6;
+    printf(" %lu records in %.3f s: %.0f records/sec, %.1f MB/s\n",
+           read, seconds, read / seconds, mb / seconds);
+    printf(" %ld context switches, %.0f per MB\n", csw, mb > 0 ? csw / mb : 0);
+    printf(" checks:\n");
+    printf("   written %lu, read %lu, missing %lu, bad %lu\n", written, read, missing, bad);
+    errors += (bad > 0 || missing > 0 || written != read);
+
+    printf(" %s\n", errors ? "FAILED" : "PASSED");
+    pthread_barrier_destroy(&producers_open);
+    free(seen);
+    free(workers);
+
+#ifdef UCOMPAT
+    ucompat_unload();
+#endif
+    return errors ? 1 : 0;
+}
@@ -5,10 +5,19 @@
         Maintains a kernel fifo
 
     USAGE:
+        insmod fifomod.ko [buffer_size=<bytes>]
+        It behaves as a pipe: a read returns what there is, up to its length,
+        and a write blocks until all of it is in the fifo. Writes up to
+        PIPE_BUF bytes are atomic, longer ones go in chunks as space frees.
 
     CONDITIONAL COMPILATION
 
     COMMENTARIES
+        While there is a single prod and a single cons, reads and writes take
+        a lock free path: each side only moves its own index of the buffer,
+        and mtx is only taken to sleep, or to wake the other side. The kernel
+        runs the calls on a file one at a time, so there is one reader and
+        one writer at most. With more prods or cons every call takes mtx.
 
 =======================================================================================
 */
@@ -18,7 +27,11 @@
 #include <linux/kernel.h>
 #include <linux/proc_fs.h>
 #include <linux/vmalloc.h>
-#include <linux/semaphore.h>
+#include <linux/mutex.h>
+#include <linux/wait.h>
+#include <linux/limits.h>
+#include <linux/cache.h>
+#include <linux/sched.h>
 
 #include <asm-generic/uaccess.h>
 #include <asm-generic/errno.h>
@@ -34,40 +47,129 @@ MODULE_DESCRIPTION("Modlist kernel module - FDI-UCM");
 MODULE_AUTHOR("Daniel Pinto, Javier Bermudez");
 
 
-#define MAX_BUFF_ITEMS 50
-#define MAX_KBUFF MAX_BUFF_ITEMS
+#define MAX_BUFFER_SIZE (64 << 20)
 #define MODULE_NAME "fifoproc"
 
+static unsigned int buffer_size = 64 << 10;
+module_param(buffer_size, uint, 0444);
+MODULE_PARM_DESC(buffer_size, "Capacity of the fifo in bytes, up to 64 MB");
+
+/* Writes up to this length are atomic. Longer ones are done in pieces of it */
+#define WRITE_CHUNK min_t(size_t, PIPE_BUF, buffer_size)
+
 static struct proc_dir_entry *proc_entry;
 
 cbuffer_t *buffer;
 int prod_count = 0;
 int cons_count = 0;
 
-struct semaphore mtx;
-struct semaphore sem_prod;
-struct semaphore sem_cons;
+struct mutex mtx;
+wait_queue_head_t prod_queue;   /* prods waiting for a cons, or for gaps */
+wait_queue_head_t cons_queue;   /* cons waiting for a prod, or for items */
 
 int nr_prod_waiting = 0;
 int nr_cons_waiting = 0;
 
+/* Shortest write (read) of the waiting prods (cons), UINT_MAX if none waits */
+unsigned int prod_need = UINT_MAX;
+unsigned int cons_need = UINT_MAX;
+
+/*
+ * Lock free path, open while fast_mode is set. It is changed with mtx held, by
+ * update_fast_mode. The files open for both read and write (rdwr_count) read
+ * as a cons and write as a prod, so they keep it closed.
+ */
+bool fast_mode = false;
+int rdwr_count = 0;
+
+/* Set while the prod (cons) is in the lock free path, each in its own cacheline */
+int prod_fast ____cacheline_aligned_in_smp = 0;
+int cons_fast ____cacheline_aligned_in_smp = 0;
+
+/*
+ * enters the lock free path, false if it is closed. Either this sees the path
+ * closed or update_fast_mode sees "fast" set and waits for it to be cleared
+ */
+static inline bool enter_fast(int *fast) {
+    /* not to pay the barrier with more prods or cons */
+    if (!READ_ONCE(fast_mode)) {
+        return false;
+    }
+    WRITE_ONCE(*fast, 1);
+    smp_mb();
+    if (READ_ONCE(fast_mode)) {
+        return true;
+    }
+    smp_store_release(fast, 0);
+    return false;
+}
+
+static inline void exit_fast(int *fast) {
+    smp_store_release(fast, 0);
+}
+
+/*
+ * waits in "queue" until "cond" holds. It behaves the same as a var_cond_wait
+ * loop on mtx, but interruptible. "len" is what the caller needs from the
+ * buffer, the wakers use it to wake the queue only if it can progress.
+ * cond is checked without the mutex to sleep, and again with it.
+ * mtx is held when it returns, 0 or -EINTR if interrupted
+ */
+#define fifo_wait(queue, waiting, need, len, cond) ({       \
+    int __ret = 0;                                          \
+    while (!(cond)) {                                       \
+        (waiting)++;                                        \
+        if ((len) < (need))                                 \
+            WRITE_ONCE(need, len);                          \
+        mutex_unlock(&mtx);                                 \
+        __ret = wait_event_interruptible(queue, cond);      \
+        mutex_lock(&mtx);                                   \
+        if (--(waiting) == 0)                               \
+            WRITE_ONCE(need, UINT_MAX);                     \
+        if (__ret) {                                        \
+            __ret = -EINTR;                                 \
+            break;                                          \
+        }                                                   \
+    }                                                       \
+    __ret;                                                  \
+})
+
+/*
+ * wakes the prods if the shortest of their writes fits now. It does not need
+ * mtx: a waiter sets prod_need before it checks the room again (fifo_wait), and
+ * whoever made the room calls this after a barrier (smp_mb, or mtx)
+ */
+void wake_prods(void);
+
 /*
- * waits in the "sem" queue until someone wakes it
- * It behaves the same as var_cond_wait, but interruptible
- * If interrupted, it does not have the mutex. Do not try to release it
- * returns 0, or -1 if interrupted
+ * wakes the cons if the shortest of their reads can be done now, the same
+ * as wake_prods
  */
-int sem_wait_interruptible(struct semaphore *sem, struct semaphore *mutex, int *waiting);
+void wake_cons(void);
 
 /*
- * wakes a process waiting in "sem" queue
+ * opens the lock free path if there are a single prod and a single cons, and
+ * closes it if not (mtx held). Closing waits for the sides inside to leave,
+ * which does not take long: inside they neither wait for the other nor take mtx
  */
-void sem_signal(struct semaphore *sem, int *waiting);
+void update_fast_mode(void);
 
 /*
- * wakes all proccesses waiting in "sem" queue
+ * copy up to len bytes from the buffer to the user (from the user to the
+ * buffer) and remove (insert) just what could be copied. They set *ret to
+ * -EFAULT if not all of it could
  */
-void sem_broadcast(struct semaphore *sem, int *waiting);
+size_t fifo_get(char __user *buf, size_t len, int *ret);
+size_t fifo_put(const char __user *buf, size_t len, int *ret);
+
+/*
+ * a read or a step of a write through the lock free path, that returns 0 if it
+ * is closed or if it has to wait. Then the locked path does the wait.
+ */
+size_t read_fast(char __user *buf, size_t len, int *ret);
+size_t write_fast(const char __user *buf, size_t len, int *ret);
+size_t read_locked(char __user *buf, size_t len, int *ret);
+size_t write_locked(const char __user *buf, size_t len, int *ret);
 
 /*****************************************************************************
  *
@@ -76,45 +178,55 @@ void sem_broadcast(struct semaphore *sem, int *waiting);
  ****************************************************************************/
 static int fifoproc_open(struct inode *inode, struct file *file) {
 
-    if (down_interruptible(&mtx)) {
+    if (mutex_lock_interruptible(&mtx)) {
         trace_printk(MODULE_NAME": Interrupted in open mutex\n");
         return -EINTR;
     }
     
 	if (file->f_mode & FMODE_READ) {
 		cons_count++;
+        if (file->f_mode & FMODE_WRITE) {
+            rdwr_count++;
+        }
+        update_fast_mode();
     
         /* If it is the only cons, all the possible prods must be waiting for it */
         if( cons_count == 1 ) {
-            sem_broadcast(&sem_prod, &nr_prod_waiting);
+            wake_up_interruptible_all(&prod_queue);
         }
 
         /* If there are no prods, wait for someone to come */
-        while( prod_count <= 0 ) {
-            if (sem_wait_interruptible(&sem_cons, &mtx, &nr_cons_waiting)) {
-                trace_printk(MODULE_NAME": Interrupted in open condvar\n");
-                return -EINTR;
+        if (fifo_wait(cons_queue, nr_cons_waiting, cons_need, 0, prod_count > 0)) {
+            cons_count--;
+            if (file->f_mode & FMODE_WRITE) {
+                rdwr_count--;
             }
+            update_fast_mode();
+            mutex_unlock(&mtx);
+            trace_printk(MODULE_NAME": Interrupted in open condvar\n");
+            return -EINTR;
         }
         trace_printk(MODULE_NAME": CONS registered\n");
 	} else{
 	    prod_count++;
+        update_fast_mode();
 
         /* If it is the only prod, all the possible cons must be waiting for it */
         if( prod_count == 1 ) {
-            sem_broadcast(&sem_cons, &nr_cons_waiting);
+            wake_up_interruptible_all(&cons_queue);
         }
 
          /* If there are no cons, wait for someone to come */
-        while( cons_count <= 0 ) {
-            if (sem_wait_interruptible(&sem_prod, &mtx, &nr_prod_waiting)) {
-                trace_printk(MODULE_NAME": Interrupted in open condvar\n");
-                return -EINTR;
-            }
+        if (fifo_wait(prod_queue, nr_prod_waiting, prod_need, 0, cons_count > 0)) {
+            prod_count--;
+            update_fast_mode();
+            mutex_unlock(&mtx);
+            trace_printk(MODULE_NAME": Interrupted in open condvar\n");
+            return -EINTR;
         }
         trace_printk(MODULE_NAME": PROD registered\n");
 	}
-    up(&mtx);
+    mutex_unlock(&mtx);
 
     return 0;
 }
@@ -122,18 +234,20 @@ static int fifoproc_open(struct inode *inode, struct file *file) {
 
 static int fifoproc_release(struct inode *inode, struct file *file) {
 
-    if (down_interruptible(&mtx)) {
-        trace_printk(MODULE_NAME": Interrupted in release mutex\n");
-        return -EINTR;
-    }
+    /* release can not fail, the file is closed anyway */
+    mutex_lock(&mtx);
 
 	if ( file->f_mode & FMODE_READ ){
         trace_printk(MODULE_NAME": CONS unregistered\n");
 		cons_count--;
+        if (file->f_mode & FMODE_WRITE) {
+            rdwr_count--;
+        }
 	} else{
         trace_printk(MODULE_NAME": PROD unregistered\n");
 	    prod_count--;
 	}
+    update_fast_mode();
 
     /* No one is using the fifo, clear its content */
     if( (cons_count == 0) && (prod_count == 0) ) {
@@ -141,121 +255,67 @@ static int fifoproc_release(struct inode *inode, struct file *file) {
     }    
     /* As there are no cons, wake all the waiting prods to allow them realize this situation */
     else if( cons_count == 0 ) {
-        sem_broadcast(&sem_prod, &nr_prod_waiting);
+        wake_up_interruptible_all(&prod_queue);
     }
     /* As there are no prods, wake all the waiting cons to allow them realize this situation */
     else if( prod_count == 0 ) {
-        sem_broadcast(&sem_cons, &nr_cons_waiting);
+        wake_up_interruptible_all(&cons_queue);
     }
 
-    up(&mtx);
+    mutex_unlock(&mtx);
 
     return 0;
 }
 
 
 static ssize_t fifoproc_read(struct file *filp, char __user *buf, size_t len, loff_t *off) {
-    char kbuffer[MAX_KBUFF];
-    int actual_len;
+    size_t done;
+    int ret = 0;
 
-/*
-    if ((*off) > 0) {
-        trace_printk(MODULE_NAME": Can not read with offset\n");
+    if (len == 0) {
         return 0;
     }
-*/
-    if ((len > MAX_BUFF_ITEMS) || (len > MAX_KBUFF)) {
-        trace_printk(MODULE_NAME": Too much items to read\n");
-        return -ENOSPC;
-    }
 
-    if (down_interruptible(&mtx)) {
-        trace_printk(MODULE_NAME": Interrupted in read mutex\n");
-        return -EINTR;
+    /* without mtx if there is something to read, else wait for it */
+    done = read_fast(buf, len, &ret);
+    if (done == 0 && ret == 0) {
+        done = read_locked(buf, len, &ret);
     }
 
-
-    while( size_cbuffer_t(buffer) < len && prod_count > 0 ) {
-        if (sem_wait_interruptible(&sem_cons, &mtx, &nr_cons_waiting)) {
-            trace_printk(MODULE_NAME": Interrupted in open condvar\n");
-            return -EINTR;
-        }
-    }
-
-    /* no prods and the buffer is empty */
-    if( prod_count == 0 && is_empty_cbuffer_t(buffer) ) {
-        up(&mtx);
-        trace_printk(MODULE_NAME": no prods and buff is empty\n");
-        return 0;
-    }
-
-
-    actual_len = (len <= size_cbuffer_t(buffer))? len : size_cbuffer_t(buffer);
-    remove_items_cbuffer_t(buffer, kbuffer, actual_len);
-
-    // Despertar a posibles productores bloqueados
-    sem_signal(&sem_prod, &nr_prod_waiting);
-
-    // Liberar el MUTEX
-    up(&mtx);
-
-    if (copy_to_user(buf, kbuffer, actual_len)) {
-        trace_printk(MODULE_NAME": Could not copy to user\n");
-        return -EINVAL;
+    /* 0 as well when there are no prods and the buffer is empty */
+    if (done == 0) {
+        return ret;
     }
-
-    (*off) += actual_len;
+    (*off) += done;
     
-    return actual_len;
+    return done;
 }
 
 
 static ssize_t fifoproc_write(struct file *filp, const char __user *buf, size_t len, loff_t *off) {
-    char kbuffer[MAX_KBUFF];
-/*
-    if ((*off) > 0) {
-        trace_printk(MODULE_NAME": Can not write with offset\n");
-        return 0;
-    }
-*/
-    if ((len > MAX_BUFF_ITEMS) || (len > MAX_KBUFF)) {
-        trace_printk(MODULE_NAME": Too much items to write\n");
-        return -ENOSPC;
-    }
-    if (copy_from_user(kbuffer, buf, len)) {
-        trace_printk(MODULE_NAME": Could not copy from user\n");
-        return -EINVAL;
-    }
-    (*off) += len;	
+    size_t done = 0, n;
+    int ret = 0;
 
-    if (down_interruptible(&mtx)) {
-        trace_printk(MODULE_NAME": Interrupted in write mutex\n");
-        return -EINTR;
+    if (len == 0) {
+        return 0;
     }
 
-    while( nr_gaps_cbuffer_t(buffer) < len && cons_count>0 ) {
-        if (sem_wait_interruptible(&sem_prod, &mtx, &nr_prod_waiting)) {
-            trace_printk(MODULE_NAME": Interrupted in open condvar\n");
-            return -EINTR;
+    while (done < len && ret == 0) {
+        /* without mtx while there is room, else wait for it */
+        n = write_fast(buf + done, len - done, &ret);
+        if (n == 0 && ret == 0) {
+            n = write_locked(buf + done, len - done, &ret);
         }
+        done += n;
     }
 
-
-    if ( cons_count == 0 ) {
-        up(&mtx);
-        trace_printk(MODULE_NAME": No cons registered\n");
-        return -EPIPE;
+    /* as in a pipe, what is written counts even if the rest failed */
+    if (done == 0) {
+        return ret;
     }
+    (*off) += done;
 
-    insert_items_cbuffer_t(buffer, kbuffer, len);
-
-    // Despertar a posibles consumidores bloqueados
-    sem_signal(&sem_cons, &nr_cons_waiting);
-    
-    // liberar el MUTEX
-    up(&mtx);
-
-    return len;
+    return done;
 }
 
 
@@ -280,19 +340,24 @@ static const struct file_operations proc_entry_fops = {
  ****************************************************************************/
 int init_fifoproc_module( void ) {
 
+    if (buffer_size == 0 || buffer_size > MAX_BUFFER_SIZE) {
+        printk(KERN_INFO MODULE_NAME": buffer_size must be 1 to %d bytes\n", MAX_BUFFER_SIZE);
+        return -EINVAL;
+    }
+
     /* init resources */
-    buffer = create_cbuffer_t(MAX_BUFF_ITEMS);
+    buffer = create_cbuffer_t(buffer_size);
     if (buffer == NULL) {
         printk(KERN_INFO MODULE_NAME": Can't create the list buffer");
         return -ENOMEM;
     }
 
-    /* condvar-like semaphores to sync prods and cons */
-    sema_init(&sem_cons, 0);
-    sema_init(&sem_prod, 0);
+    /* wait queues to sync prods and cons */
+    init_waitqueue_head(&cons_queue);
+    init_waitqueue_head(&prod_queue);
    
-    /* mutex-like semaphore for mutual exclusion */ 
-    sema_init(&mtx, 1);
+    /* mutex for mutual exclusion */ 
+    mutex_init(&mtx);
 
 
     /* create module entry */
@@ -329,45 +394,212 @@ module_exit( cleanup_fifoproc_module );
 
 /*****************************************************************************
  *
- * Semaphore-based syncronization functions
+ * Wait queue based syncronization functions
  *
  ****************************************************************************/
-int sem_wait_interruptible(struct semaphore *sem, struct semaphore *mutex, int *waiting) {
+void wake_prods(void) {
+    if (nr_gaps_cbuffer_t(buffer) >= READ_ONCE(prod_need)) {
+        wake_up_interruptible(&prod_queue);
+    }
+}
 
-    (*waiting)++;
-    
-    /* release the mutex */
-    up(mutex);
 
-    /* wait to be waken */
-    if (down_interruptible(sem)) {
-        down(mutex);
-        (*waiting)--;
-        up(mutex);
-        return -1;
+void wake_cons(void) {
+    if (size_cbuffer_t(buffer) >= READ_ONCE(cons_need)) {
+        wake_up_interruptible(&cons_queue);
     }
+}
+
 
-    /* get the mutex */
-    if (down_interruptible(mutex)) {
-        return -1;
+void update_fast_mode(void) {
+    bool fast = prod_count == 1 && cons_count == 1 && rdwr_count == 0;
+
+    if (fast == fast_mode) {
+        return;
     }
+    WRITE_ONCE(fast_mode, fast);
 
-    return 0;
+    if (!fast) {
+        smp_mb();
+        while (READ_ONCE(prod_fast) || READ_ONCE(cons_fast)) {
+            cond_resched();
+        }
+    }
+}
+
+
+
+/*****************************************************************************
+ *
+ * Read and write paths
+ *
+ ****************************************************************************/
+size_t fifo_get(char __user *buf, size_t len, int *ret) {
+    char *seg[2];
+    int seg_len[2], nr_segs, i;
+    size_t done = 0, chunk, left = 0;
+
+    /* straight from the buffer, in at most two pieces */
+    nr_segs = used_segments_cbuffer_t(buffer, seg, seg_len);
+    for (i = 0; i < nr_segs && done < len && left == 0; i++) {
+        chunk = min_t(size_t, len - done, seg_len[i]);
+        left = copy_to_user(buf + done, seg[i], chunk);
+        done += chunk - left;
+    }
+    if (left) {
+        trace_printk(MODULE_NAME": Could not copy to user\n");
+        *ret = -EFAULT;
+    }
+
+    discard_items_cbuffer_t(buffer, done);
+
+    return done;
 }
 
 
-void sem_signal(struct semaphore *sem, int *waiting) {
-    if (*waiting > 0) {
-        up(sem);
-        (*waiting)--;
+size_t fifo_put(const char __user *buf, size_t len, int *ret) {
+    char *seg[2];
+    int seg_len[2], nr_segs, i;
+    size_t done = 0, chunk, left = 0;
+
+    /* straight from the user, in at most two pieces */
+    nr_segs = free_segments_cbuffer_t(buffer, seg, seg_len);
+    for (i = 0; i < nr_segs && done < len && left == 0; i++) {
+        chunk = min_t(size_t, len - done, seg_len[i]);
+        left = copy_from_user(seg[i], buf + done, chunk);
+        done += chunk - left;
+    }
+    if (left) {
+        trace_printk(MODULE_NAME": Could not copy from user\n");
+        *ret = -EFAULT;
+    }
+
+    commit_items_cbuffer_t(buffer, done);
+
+    return done;
+}
+
+
+size_t read_fast(char __user *buf, size_t len, int *ret) {
+    size_t done = 0;
+
+    if (!enter_fast(&cons_fast)) {
+        return 0;
+    }
+    if (!is_empty_cbuffer_t(buffer)) {
+        done = fifo_get(buf, len, ret);
+    }
+    exit_fast(&cons_fast);
+
+    /* A prod that found no room may be going to sleep, see wake_prods */
+    if (done > 0) {
+        smp_mb();
+        wake_prods();
+    }
+
+    return done;
+}
+
+
+size_t write_fast(const char __user *buf, size_t len, int *ret) {
+    size_t done = 0;
+
+    if (!enter_fast(&prod_fast)) {
+        return 0;
+    }
+    /* the whole write if it is short, so that it is atomic */
+    if (nr_gaps_cbuffer_t(buffer) >= min_t(size_t, len, WRITE_CHUNK)) {
+        done = fifo_put(buf, len, ret);
     }
+    exit_fast(&prod_fast);
+
+    /* A cons that found nothing to read may be going to sleep */
+    if (done > 0) {
+        smp_mb();
+        wake_cons();
+    }
+
+    return done;
 }
 
 
-void sem_broadcast(struct semaphore *sem, int *waiting) {
-    while (*waiting > 0) {
-        up(sem);
-        (*waiting)--;
+size_t read_locked(char __user *buf, size_t len, int *ret) {
+    size_t done;
+
+    if (mutex_lock_interruptible(&mtx)) {
+        trace_printk(MODULE_NAME": Interrupted in read mutex\n");
+        *ret = -EINTR;
+        return 0;
+    }
+
+    /* as in a pipe, wait just for something to read */
+    if (fifo_wait(cons_queue, nr_cons_waiting, cons_need, 1,
+                  !is_empty_cbuffer_t(buffer) || prod_count == 0)) {
+        mutex_unlock(&mtx);
+        trace_printk(MODULE_NAME": Interrupted in read condvar\n");
+        *ret = -EINTR;
+        return 0;
+    }
+
+    /* no prods and the buffer is empty */
+    if( prod_count == 0 && is_empty_cbuffer_t(buffer) ) {
+        mutex_unlock(&mtx);
+        trace_printk(MODULE_NAME": no prods and buff is empty\n");
+        return 0;
     }
+
+    /* take what there is, up to len */
+    done = fifo_get(buf, len, ret);
+
+    // Despertar a los productores bloqueados si ya cabe alguna escritura
+    wake_prods();
+
+    // Liberar el MUTEX
+    mutex_unlock(&mtx);
+
+    return done;
 }
 
+
+size_t write_locked(const char __user *buf, size_t len, int *ret) {
+    size_t done = 0, need;
+
+    if (mutex_lock_interruptible(&mtx)) {
+        trace_printk(MODULE_NAME": Interrupted in write mutex\n");
+        *ret = -EINTR;
+        return 0;
+    }
+
+    while (done < len) {
+        /* the whole write if it is short, so that it is atomic */
+        need = min_t(size_t, len - done, WRITE_CHUNK);
+        if (fifo_wait(prod_queue, nr_prod_waiting, prod_need, need,
+                      nr_gaps_cbuffer_t(buffer) >= need || cons_count == 0)) {
+            trace_printk(MODULE_NAME": Interrupted in write condvar\n");
+            *ret = -EINTR;
+            break;
+        }
+
+        if ( cons_count == 0 ) {
+            trace_printk(MODULE_NAME": No cons registered\n");
+            *ret = -EPIPE;
+            break;
+        }
+
+        /* fill all the gaps there are */
+        done += fifo_put(buf + done, len - done, ret);
+
+        // Despertar a los consumidores bloqueados si ya se puede alguna lectura
+        wake_cons();
+
+        /* the rest without mtx if the lock free path is open now */
+        if (*ret || fast_mode) {
+            break;
+        }
+    }
+    
+    // liberar el MUTEX
+    mutex_unlock(&mtx);
+
+    return done;
+}
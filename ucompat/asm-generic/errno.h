@@ -0,0 +1,2 @@
+/* The system header, glibc reaches it from <errno.h> */
+#include_next <asm-generic/errno.h>
@@ -0,0 +1 @@
+#include "../ucompat.h"
@@ -0,0 +1 @@
+#error "RCU_MODE is not supported in user space builds"
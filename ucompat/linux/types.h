@@ -0,0 +1,2 @@
+/* The system header, ucompat.h uses its __u32 and friends */
+#include_next <linux/types.h>
@@ -0,0 +1 @@
+/* Tracepoints are empty functions in user space, there is nothing to define */
@@ -0,0 +1,985 @@
+/*
+ * ucompat.c: the parts of ucompat.h that are not inline, and the calls of
+ * ucompat_user.h that reach the /proc entries of the module
+ */
+
+#include <stdarg.h>
+#include <fcntl.h>
+#include "ucompat.h"
+#include "ucompat_user.h"
+
+#define PROC_PATH_LENGHT 128
+#define MAX_FILES 1024
+#define MAX_PARAMS 32
+
+int ucompat_module_init(void);
+void ucompat_module_exit(void);
+
+
+/*****************************************************************************
+ * Semaphores
+ *****************************************************************************/
+
+void sema_init(struct semaphore *sem, int val) {
+    pthread_mutex_init(&sem->lock, NULL);
+    pthread_cond_init(&sem->wait, NULL);
+    sem->count = val;
+}
+
+void down(struct semaphore *sem) {
+    pthread_mutex_lock(&sem->lock);
+    while (sem->count <= 0)
+        pthread_cond_wait(&sem->wait, &sem->lock);
+    sem->count--;
+    pthread_mutex_unlock(&sem->lock);
+}
+
+/* There are no signals to interrupt it */
+int down_interruptible(struct semaphore *sem) {
+    down(sem);
+    return 0;
+}
+
+void up(struct semaphore *sem) {
+    pthread_mutex_lock(&sem->lock);
+    sem->count++;
+    pthread_cond_signal(&sem->wait);
+    pthread_mutex_unlock(&sem->lock);
+}
+
+
+/*****************************************************************************
+ * list_sort, a stable merge sort like the one of lib/list_sort.c
+ *****************************************************************************/
+
+typedef int (*list_cmp_t)(void *priv, struct list_head *a, struct list_head *b);
+
+/* Merges two NULL terminated lists, linked only by next */
+static struct list_head *merge(void *priv, list_cmp_t cmp, struct list_head *a, struct list_head *b) {
+    struct list_head head, *tail = &head;
+
+    while (a && b) {
+        /* if equal, take a: that keeps the original order */
+        if (cmp(priv, a, b) <= 0) {
+            tail->next = a;
+            a = a->next;
+        } else {
+            tail->next = b;
+            b = b->next;
+        }
+        tail = tail->next;
+    }
+    tail->next = a ? a : b;
+    return head.next;
+}
+
+static struct list_head *merge_sort(void *priv, list_cmp_t cmp, struct list_head *list, size_t count) {
+    struct list_head *second, *prev = NULL;
+    size_t i;
+
+    if (count < 2)
+        return list;
+
+    second = list;
+    for (i = 0; i < count / 2; i++) {
+        prev = second;
+        second = second->next;
+    }
+    prev->next = NULL;
+
+    return merge(priv, cmp, merge_sort(priv, cmp, list, count / 2),
+                 merge_sort(priv, cmp, second, count - count / 2));
+}
+
+void list_sort(void *priv, struct list_head *head, list_cmp_t cmp) {
+    struct list_head *list, *pos, *prev;
+    size_t count = 0;
+
+    if (list_empty(head))
+        return;
+
+    list_for_each(pos, head)
+        count++;
+    head->prev->next = NULL;
+    list = merge_sort(priv, cmp, head->next, count);
+
+    /* rebuild the prev links */
+    prev = head;
+    for (pos = list; pos; pos = pos->next) {
+        prev->next = pos;
+        pos->prev = prev;
+        prev = pos;
+    }
+    prev->next = head;
+    head->prev = prev;
+}
+
+
+/*****************************************************************************
+ * rbtree, the red-black tree of the textbooks behind the lib/rbtree.c calls
+ *****************************************************************************/
+
+/* Puts new where old was under parent, NULL for the root */
+static void rb_change_child(struct rb_node *old, struct rb_node *new,
+                            struct rb_node *parent, struct rb_root *root) {
+    if (parent == NULL)
+        root->rb_node = new;
+    else if (parent->rb_left == old)
+        parent->rb_left = new;
+    else
+        parent->rb_right = new;
+}
+
+static void rb_rotate_left(struct rb_node *x, struct rb_root *root) {
+    struct rb_node *y = x->rb_right;
+
+    x->rb_right = y->rb_left;
+    if (y->rb_left)
+        y->rb_left->rb_parent = x;
+    y->rb_parent = x->rb_parent;
+    rb_change_child(x, y, x->rb_parent, root);
+    y->rb_left = x;
+    x->rb_parent = y;
+}
+
+static void rb_rotate_right(struct rb_node *x, struct rb_root *root) {
+    struct rb_node *y = x->rb_left;
+
+    x->rb_left = y->rb_right;
+    if (y->rb_right)
+        y->rb_right->rb_parent = x;
+    y->rb_parent = x->rb_parent;
+    rb_change_child(x, y, x->rb_parent, root);
+    y->rb_right = x;
+    x->rb_parent = y;
+}
+
+#define rb_is_red(node) ((node) != NULL && (node)->rb_red)
+
+void rb_insert_color(struct rb_node *node, struct rb_root *root) {
+    struct rb_node *parent, *gparent, *uncle;
+
+    while ((parent = node->rb_parent) && parent->rb_red) {
+        /* a red parent is never the root, so there is a grandparent */
+        gparent = parent->rb_parent;
+        if (parent == gparent->rb_left) {
+            uncle = gparent->rb_right;
+            if (rb_is_red(uncle)) {
+                parent->rb_red = uncle->rb_red = 0;
+                gparent->rb_red = 1;
+                node = gparent;
+                continue;
+            }
+            if (node == parent->rb_right) {
+                rb_rotate_left(parent, root);
+                node = parent;
+                parent = node->rb_parent;
+            }
+            parent->rb_red = 0;
+            gparent->rb_red = 1;
+            rb_rotate_right(gparent, root);
+        } else {
+            uncle = gparent->rb_left;
+            if (rb_is_red(uncle)) {
+                parent->rb_red = uncle->rb_red = 0;
+                gparent->rb_red = 1;
+                node = gparent;
+                continue;
+            }
+            if (node == parent->rb_left) {
+                rb_rotate_right(parent, root);
+                node = parent;
+                parent = node->rb_parent;
+            }
+            parent->rb_red = 0;
+            gparent->rb_red = 1;
+            rb_rotate_left(gparent, root);
+        }
+    }
+    root->rb_node->rb_red = 0;
+}
+
+/* node (maybe NULL) under parent is one black short after an erase */
+static void rb_erase_color(struct rb_node *node, struct rb_node *parent, struct rb_root *root) {
+    struct rb_node *sibling;
+
+    while (node != root->rb_node && !rb_is_red(node)) {
+        if (node == parent->rb_left) {
+            sibling = parent->rb_right;
+            if (sibling->rb_red) {
+                sibling->rb_red = 0;
+                parent->rb_red = 1;
+                rb_rotate_left(parent, root);
+                sibling = parent->rb_right;
+            }
+            if (!rb_is_red(sibling->rb_left) && !rb_is_red(sibling->rb_right)) {
+                sibling->rb_red = 1;
+                node = parent;
+                parent = node->rb_parent;
+                continue;
+            }
+            if (!rb_is_red(sibling->rb_right)) {
+                sibling->rb_left->rb_red = 0;
+                sibling->rb_red = 1;
+                rb_rotate_right(sibling, root);
+                sibling = parent->rb_right;
+            }
+            sibling->rb_red = parent->rb_red;
+            parent->rb_red = 0;
+            sibling->rb_right->rb_red = 0;
+            rb_rotate_left(parent, root);
+        } else {
+            sibling = parent->rb_left;
+            if (sibling->rb_red) {
+                sibling->rb_red = 0;
+                parent->rb_red = 1;
+                rb_rotate_right(parent, root);
+                sibling = parent->rb_left;
+            }
+            if (!rb_is_red(sibling->rb_left) && !rb_is_red(sibling->rb_right)) {
+                sibling->rb_red = 1;
+                node = parent;
+                parent = node->rb_parent;
+                continue;
+            }
+            if (!rb_is_red(sibling->rb_left)) {
+                sibling->rb_right->rb_red = 0;
+                sibling->rb_red = 1;
+                rb_rotate_left(sibling, root);
+                sibling = parent->rb_left;
+            }
+            sibling->rb_red = parent->rb_red;
+            parent->rb_red = 0;
+            sibling->rb_left->rb_red = 0;
+            rb_rotate_right(parent, root);
+        }
+        node = root->rb_node;
+        break;
+    }
+    if (node)
+        node->rb_red = 0;
+}
+
+void rb_erase(struct rb_node *node, struct rb_root *root) {
+    struct rb_node *gone = node, *child, *parent;
+    int red;
+
+    /* the node taken out of the tree has one child at most: node or its successor */
+    if (node->rb_left && node->rb_right)
+        for (gone = node->rb_right; gone->rb_left; gone = gone->rb_left)
+            ;
+    child = gone->rb_left ? gone->rb_left : gone->rb_right;
+    parent = gone->rb_parent;
+    red = gone->rb_red;
+    if (child)
+        child->rb_parent = parent;
+    rb_change_child(gone, child, parent, root);
+
+    /* the successor takes the place of node */
+    if (gone != node) {
+        if (parent == node)
+            parent = gone;
+        gone->rb_left = node->rb_left;
+        gone->rb_right = node->rb_right;
+        gone->rb_parent = node->rb_parent;
+        gone->rb_red = node->rb_red;
+        if (gone->rb_left)
+            gone->rb_left->rb_parent = gone;
+        if (gone->rb_right)
+            gone->rb_right->rb_parent = gone;
+        rb_change_child(node, gone, node->rb_parent, root);
+    }
+
+    if (!red)
+        rb_erase_color(child, parent, root);
+}
+
+struct rb_node *rb_first(const struct rb_root *root) {
+    struct rb_node *n = root->rb_node;
+
+    while (n && n->rb_left)
+        n = n->rb_left;
+    return n;
+}
+
+struct rb_node *rb_last(const struct rb_root *root) {
+    struct rb_node *n = root->rb_node;
+
+    while (n && n->rb_right)
+        n = n->rb_right;
+    return n;
+}
+
+struct rb_node *rb_next(const struct rb_node *node) {
+    struct rb_node *parent;
+
+    if (node->rb_right) {
+        node = node->rb_right;
+        while (node->rb_left)
+            node = node->rb_left;
+        return (struct rb_node *)node;
+    }
+    while ((parent = node->rb_parent) && node == parent->rb_right)
+        node = parent;
+    return parent;
+}
+
+struct rb_node *rb_prev(const struct rb_node *node) {
+    struct rb_node *parent;
+
+    if (node->rb_left) {
+        node = node->rb_left;
+        while (node->rb_right)
+            node = node->rb_right;
+        return (struct rb_node *)node;
+    }
+    while ((parent = node->rb_parent) && node == parent->rb_left)
+        node = parent;
+    return parent;
+}
+
+static struct rb_node *rb_left_deepest(const struct rb_node *node) {
+    for (;;) {
+        if (node->rb_left)
+            node = node->rb_left;
+        else if (node->rb_right)
+            node = node->rb_right;
+        else
+            return (struct rb_node *)node;
+    }
+}
+
+struct rb_node *rb_first_postorder(const struct rb_root *root) {
+    return root->rb_node ? rb_left_deepest(root->rb_node) : NULL;
+}
+
+/* The children before their parent, so the nodes can be freed on the way */
+struct rb_node *rb_next_postorder(const struct rb_node *node) {
+    struct rb_node *parent = node->rb_parent;
+
+    if (parent == NULL)
+        return NULL;
+    if (node == parent->rb_left && parent->rb_right)
+        return rb_left_deepest(parent->rb_right);
+    return parent;
+}
+
+
+/*****************************************************************************
+ * /proc entries, found by their whole path
+ *****************************************************************************/
+
+struct proc_dir_entry {
+    char path[PROC_PATH_LENGHT];
+    const struct file_operations *fops;    // NULL for directories
+    void *data;
+    struct proc_dir_entry *next;
+};
+
+static struct proc_dir_entry *proc_entries = NULL;
+static pthread_mutex_t proc_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Returns -1 if the path does not fit */
+static int proc_path(char *path, const char *name, struct proc_dir_entry *parent) {
+    int len;
+
+    if (parent)
+        len = snprintf(path, PROC_PATH_LENGHT, "%s/%s", parent->path, name);
+    else
+        len = snprintf(path, PROC_PATH_LENGHT, "%s", name);
+    return len < PROC_PATH_LENGHT ? 0 : -1;
+}
+
+/* Call it with proc_lock */
+static struct proc_dir_entry *proc_find(const char *path) {
+    struct proc_dir_entry *entry;
+
+    for (entry = proc_entries; entry; entry = entry->next)
+        if (strcmp(entry->path, path) == 0)
+            return entry;
+    return NULL;
+}
+
+struct proc_dir_entry *proc_create_data(const char *name, int mode, struct proc_dir_entry *parent,
+                                        const struct file_operations *fops, void *data) {
+    struct proc_dir_entry *entry = calloc(1, sizeof(*entry));
+
+    if (entry == NULL)
+        return NULL;
+
+    if (proc_path(entry->path, name, parent)) {
+        free(entry);
+        return NULL;
+    }
+    entry->fops = fops;
+    entry->data = data;
+
+    pthread_mutex_lock(&proc_lock);
+    if (proc_find(entry->path)) {
+        pthread_mutex_unlock(&proc_lock);
+        free(entry);
+        return NULL;
+    }
+    entry->next = proc_entries;
+    proc_entries = entry;
+    pthread_mutex_unlock(&proc_lock);
+
+    return entry;
+}
+
+struct proc_dir_entry *proc_mkdir(const char *name, struct proc_dir_entry *parent) {
+    return proc_create_data(name, 0555, parent, NULL, NULL);
+}
+
+/* The files already open keep working with the fops and data they got */
+void remove_proc_entry(const char *name, struct proc_dir_entry *parent) {
+    char path[PROC_PATH_LENGHT];
+    struct proc_dir_entry **pos, *entry;
+
+    if (proc_path(path, name, parent))
+        return;
+
+    pthread_mutex_lock(&proc_lock);
+    for (pos = &proc_entries; *pos; pos = &(*pos)->next) {
+        if (strcmp((*pos)->path, path) == 0) {
+            entry = *pos;
+            *pos = entry->next;
+            free(entry);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&proc_lock);
+}
+
+
+/*****************************************************************************
+ * seq_file, following fs/seq_file.c
+ *****************************************************************************/
+
+int seq_open(struct file *file, const struct seq_operations *op) {
+    struct seq_file *m = calloc(1, sizeof(*m));
+
+    if (m == NULL)
+        return -ENOMEM;
+
+    pthread_mutex_init(&m->lock, NULL);
+    m->op = op;
+    file->private_data = m;
+    return 0;
+}
+
+int seq_release(struct inode *inode, struct file *file) {
+    struct seq_file *m = file->private_data;
+
+    free(m->buf);
+    pthread_mutex_destroy(&m->lock);
+    free(m);
+    return 0;
+}
+
+void *__seq_open_private(struct file *file, const struct seq_operations *op, int psize) {
+    void *private = calloc(1, psize);
+
+    if (private == NULL)
+        return NULL;
+
+    if (seq_open(file, op)) {
+        free(private);
+        return NULL;
+    }
+    ((struct seq_file *)file->private_data)->private = private;
+    return private;
+}
+
+int seq_release_private(struct inode *inode, struct file *file) {
+    free(((struct seq_file *)file->private_data)->private);
+    return seq_release(inode, file);
+}
+
+static void *single_start(struct seq_file *m, loff_t *pos) {
+    return *pos == 0 ? (void *)1 : NULL;
+}
+
+static void *single_next(struct seq_file *m, void *v, loff_t *pos) {
+    ++*pos;
+    return NULL;
+}
+
+static void single_stop(struct seq_file *m, void *v) {
+}
+
+int single_open(struct file *file, int (*show)(struct seq_file *, void *), void *data) {
+    struct seq_operations *op = malloc(sizeof(*op));
+    int res;
+
+    if (op == NULL)
+        return -ENOMEM;
+
+    op->start = single_start;
+    op->next = single_next;
+    op->stop = single_stop;
+    op->show = show;
+    res = seq_open(file, op);
+    if (res) {
+        free(op);
+        return res;
+    }
+    ((struct seq_file *)file->private_data)->private = data;
+    return 0;
+}
+
+int single_release(struct inode *inode, struct file *file) {
+    const struct seq_operations *op = ((struct seq_file *)file->private_data)->op;
+
+    seq_release(inode, file);
+    free((void *)op);
+    return 0;
+}
+
+static void seq_reset(struct seq_file *m) {
+    m->index = 0;
+    m->read_pos = 0;
+    m->count = 0;
+    m->from = 0;
+}
+
+/* Only reads in order, and again from the start after a seek to 0 */
+ssize_t seq_read(struct file *file, char __user *buf, size_t size, loff_t *ppos) {
+    struct seq_file *m = file->private_data;
+    size_t copied = 0;
+    size_t n;
+    void *p;
+    int err = 0;
+
+    pthread_mutex_lock(&m->lock);
+
+    if (*ppos == 0 && m->read_pos != 0)
+        seq_reset(m);
+
+    if (m->buf == NULL) {
+        m->size = PAGE_SIZE;
+        m->buf = malloc(m->size);
+        if (m->buf == NULL)
+            goto Enomem;
+    }
+
+    /* the rest of the last record */
+    if (m->count) {
+        n = min(m->count, size);
+        memcpy(buf, m->buf + m->from, n);
+        m->count -= n;
+        m->from += n;
+        size -= n;
+        buf += n;
+        copied += n;
+        if (!size)
+            goto Done;
+    }
+
+    /* one whole record, growing the buffer until it fits */
+    m->from = 0;
+    p = m->op->start(m, &m->index);
+    while (1) {
+        if (!p)
+            break;
+        err = m->op->show(m, p);
+        if (err < 0)
+            break;
+        if (err)
+            m->count = 0;
+        if (!m->count) {
+            p = m->op->next(m, p, &m->index);
+            continue;
+        }
+        if (m->count < m->size)
+            goto Fill;
+        m->op->stop(m, p);
+        free(m->buf);
+        m->count = 0;
+        m->size <<= 1;
+        m->buf = malloc(m->size);
+        if (m->buf == NULL)
+            goto Enomem;
+        p = m->op->start(m, &m->index);
+    }
+    m->op->stop(m, p);
+    m->count = 0;
+    goto Done;
+
+Fill:
+    /* as many records as fit in size */
+    while (1) {
+        size_t offs = m->count;
+        loff_t pos = m->index;
+
+        p = m->op->next(m, p, &m->index);
+        if (pos == m->index)
+            m->index++;
+        if (!p)
+            break;
+        if (m->count >= size)
+            break;
+        err = m->op->show(m, p);
+        if (seq_has_overflowed(m) || err) {
+            m->count = offs;
+            if (err <= 0)
+                break;
+        }
+    }
+    m->op->stop(m, p);
+    n = min(m->count, size);
+    memcpy(buf, m->buf, n);
+    copied += n;
+    m->count -= n;
+    m->from = n;
+
+Done:
+    if (!copied) {
+        copied = err;
+    } else {
+        *ppos += copied;
+        m->read_pos += copied;
+    }
+    pthread_mutex_unlock(&m->lock);
+    return copied;
+
+Enomem:
+    err = -ENOMEM;
+    goto Done;
+}
+
+loff_t seq_lseek(struct file *file, loff_t offset, int whence) {
+    struct seq_file *m = file->private_data;
+
+    if (offset != 0 || whence != SEEK_SET)
+        return -EINVAL;
+
+    pthread_mutex_lock(&m->lock);
+    seq_reset(m);
+    file->f_pos = 0;
+    pthread_mutex_unlock(&m->lock);
+    return 0;
+}
+
+void seq_printf(struct seq_file *m, const char *fmt, ...) {
+    va_list args;
+    int len;
+
+    if (m->count < m->size) {
+        va_start(args, fmt);
+        len = vsnprintf(m->buf + m->count, m->size - m->count, fmt, args);
+        va_end(args);
+        if (m->count + len < m->size) {
+            m->count += len;
+            return;
+        }
+    }
+    m->count = m->size;
+}
+
+void seq_write(struct seq_file *m, const void *data, size_t len) {
+    if (m->count + len < m->size) {
+        memcpy(m->buf + m->count, data, len);
+        m->count += len;
+        return;
+    }
+    m->count = m->size;
+}
+
+void seq_puts(struct seq_file *m, const char *s) {
+    seq_write(m, s, strlen(s));
+}
+
+void seq_putc(struct seq_file *m, char c) {
+    if (m->count < m->size)
+        m->buf[m->count++] = c;
+}
+
+
+/*****************************************************************************
+ * Module parameters
+ *****************************************************************************/
+
+typedef struct {
+    const char *name;
+    void *var;
+    ucompat_param_set_t set;
+} param_t;
+
+static param_t params[MAX_PARAMS];
+static int nr_params;
+
+void ucompat_param_register(const char *name, void *var, ucompat_param_set_t set) {
+    if (nr_params == MAX_PARAMS) {
+        fprintf(stderr, "ucompat: too many module parameters, %s ignored\n", name);
+        return;
+    }
+    params[nr_params].name = name;
+    params[nr_params].var = var;
+    params[nr_params].set = set;
+    nr_params++;
+}
+
+/* Parses a whole number of val, in any base as the kernel does */
+static int parse_number(const char *val, int is_signed, unsigned long long *res) {
+    char *end;
+
+    errno = 0;
+    *res = is_signed ? (unsigned long long)strtoll(val, &end, 0) : strtoull(val, &end, 0);
+    return (errno || end == val || *end != '\0') ? -EINVAL : 0;
+}
+
+int ucompat_param_set_int(void *var, const char *val) {
+    unsigned long long n;
+
+    if (parse_number(val, 1, &n) || (long long)n < INT_MIN || (long long)n > INT_MAX)
+        return -EINVAL;
+    *(int *)var = (int)n;
+    return 0;
+}
+
+int ucompat_param_set_uint(void *var, const char *val) {
+    unsigned long long n;
+
+    if (parse_number(val, 0, &n) || n > UINT_MAX)
+        return -EINVAL;
+    *(unsigned int *)var = (unsigned int)n;
+    return 0;
+}
+
+int ucompat_param_set_ulong(void *var, const char *val) {
+    unsigned long long n;
+
+    if (parse_number(val, 0, &n) || n > ULONG_MAX)
+        return -EINVAL;
+    *(unsigned long *)var = (unsigned long)n;
+    return 0;
+}
+
+int ucompat_param_set_bool(void *var, const char *val) {
+    switch (val[0]) {
+    case 'y': case 'Y': case '1':
+        *(bool *)var = true;
+        return 0;
+    case 'n': case 'N': case '0':
+        *(bool *)var = false;
+        return 0;
+    }
+    return -EINVAL;
+}
+
+/* The string is never freed, as the module keeps pointing to it */
+int ucompat_param_set_charp(void *var, const char *val) {
+    char *copy = strdup(val);
+
+    if (copy == NULL)
+        return -ENOMEM;
+    *(char **)var = copy;
+    return 0;
+}
+
+static int param_set(char *arg) {
+    char *val = strchr(arg, '=');
+    int i;
+
+    if (val == NULL)
+        return -EINVAL;
+    *val++ = '\0';
+
+    for (i = 0; i < nr_params; i++) {
+        if (strcmp(params[i].name, arg) == 0)
+            return params[i].set(params[i].var, val);
+    }
+    return -ENOENT;
+}
+
+static int params_load(void) {
+    const char *env = getenv("UCOMPAT_PARAMS");
+    char *args, *arg, *save;
+    int res = 0;
+
+    if (env == NULL)
+        return 0;
+
+    args = strdup(env);
+    if (args == NULL)
+        return -ENOMEM;
+
+    for (arg = strtok_r(args, " \t", &save); arg && res == 0; arg = strtok_r(NULL, " \t", &save)) {
+        res = param_set(arg);
+        if (res)
+            fprintf(stderr, "ucompat: bad module parameter %s\n", arg);
+    }
+    free(args);
+    return res;
+}
+
+
+/*****************************************************************************
+ * User side: module load and files
+ *****************************************************************************/
+
+typedef struct {
+    int used;
+    struct file file;
+    struct inode inode;
+    const struct file_operations *fops;
+    pthread_mutex_t lock;       // serializes the calls on the file
+} ufile_t;
+
+static ufile_t files[MAX_FILES];
+static pthread_mutex_t files_lock = PTHREAD_MUTEX_INITIALIZER;
+
+int ucompat_load(void) {
+    int res = params_load();
+
+    if (res == 0)
+        res = ucompat_module_init();
+
+    if (res < 0) {
+        errno = -res;
+        return -1;
+    }
+    return 0;
+}
+
+void ucompat_unload(void) {
+    ucompat_module_exit();
+}
+
+static ufile_t *file_get(int fd) {
+    if (fd < 0 || fd >= MAX_FILES || !files[fd].used) {
+        errno = EBADF;
+        return NULL;
+    }
+    return &files[fd];
+}
+
+/* Converts the result of a file operation to the one of the system call */
+static long result(long res) {
+    if (res < 0) {
+        errno = -res;
+        return -1;
+    }
+    return res;
+}
+
+int ucompat_open(const char *path, int flags) {
+    struct proc_dir_entry *entry;
+    ufile_t *uf = NULL;
+    int fd, res;
+
+    if (strncmp(path, "/proc/", 6) == 0)
+        path += 6;
+
+    pthread_mutex_lock(&files_lock);
+    for (fd = 0; fd < MAX_FILES; fd++) {
+        if (!files[fd].used) {
+            uf = &files[fd];
+            break;
+        }
+    }
+    if (uf == NULL) {
+        pthread_mutex_unlock(&files_lock);
+        errno = EMFILE;
+        return -1;
+    }
+
+    pthread_mutex_lock(&proc_lock);
+    entry = proc_find(path);
+    if (entry == NULL || entry->fops == NULL) {
+        pthread_mutex_unlock(&proc_lock);
+        pthread_mutex_unlock(&files_lock);
+        errno = entry ? EISDIR : ENOENT;
+        return -1;
+    }
+    memset(uf, 0, sizeof(*uf));
+    uf->fops = entry->fops;
+    uf->inode.i_private = entry->data;
+    pthread_mutex_unlock(&proc_lock);
+
+    uf->file.f_inode = &uf->inode;
+    uf->file.f_flags = flags;
+    if ((flags & O_ACCMODE) != O_WRONLY)
+        uf->file.f_mode |= FMODE_READ;
+    if ((flags & O_ACCMODE) != O_RDONLY)
+        uf->file.f_mode |= FMODE_WRITE;
+    pthread_mutex_init(&uf->lock, NULL);
+    uf->used = 1;
+    pthread_mutex_unlock(&files_lock);
+
+    /* the open of a fifo blocks, out of files_lock */
+    if (uf->fops->open) {
+        res = uf->fops->open(&uf->inode, &uf->file);
+        if (res < 0) {
+            pthread_mutex_lock(&files_lock);
+            pthread_mutex_destroy(&uf->lock);
+            uf->used = 0;
+            pthread_mutex_unlock(&files_lock);
+            errno = -res;
+            return -1;
+        }
+    }
+    return fd;
+}
+
+ssize_t ucompat_read(int fd, void *buf, size_t count) {
+    ufile_t *uf = file_get(fd);
+    ssize_t res;
+
+    if (uf == NULL)
+        return -1;
+    if (!(uf->file.f_mode & FMODE_READ) || uf->fops->read == NULL)
+        return result(-EINVAL);
+
+    pthread_mutex_lock(&uf->lock);
+    res = uf->fops->read(&uf->file, buf, count, &uf->file.f_pos);
+    pthread_mutex_unlock(&uf->lock);
+    return result(res);
+}
+
+ssize_t ucompat_write(int fd, const void *buf, size_t count) {
+    ufile_t *uf = file_get(fd);
+    ssize_t res;
+
+    if (uf == NULL)
+        return -1;
+    if (!(uf->file.f_mode & FMODE_WRITE) || uf->fops->write == NULL)
+        return result(-EINVAL);
+
+    pthread_mutex_lock(&uf->lock);
+    res = uf->fops->write(&uf->file, buf, count, &uf->file.f_pos);
+    pthread_mutex_unlock(&uf->lock);
+    return result(res);
+}
+
+long ucompat_ioctl(int fd, unsigned int cmd, unsigned long arg) {
+    ufile_t *uf = file_get(fd);
+    long res;
+
+    if (uf == NULL)
+        return -1;
+    if (uf->fops->unlocked_ioctl == NULL)
+        return result(-ENOTTY);
+
+    pthread_mutex_lock(&uf->lock);
+    res = uf->fops->unlocked_ioctl(&uf->file, cmd, arg);
+    pthread_mutex_unlock(&uf->lock);
+    return result(res);
+}
+
+int ucompat_close(int fd) {
+    ufile_t *uf = file_get(fd);
+
+    if (uf == NULL)
+        return -1;
+
+    if (uf->fops->release)
+        uf->fops->release(&uf->inode, &uf->file);
+
+    pthread_mutex_lock(&files_lock);
+    pthread_mutex_destroy(&uf->lock);
+    uf->used = 0;
+    pthread_mutex_unlock(&files_lock);
+    return 0;
+}
@@ -0,0 +1,710 @@
+/*=====================================================================================
+    LIBRARY: ucompat
+
+    DESCRIPTION:
+        Thin user space version of the kernel interfaces used by modlist
+        (ParteA) and fifoproc (ParteB), so their sources build unchanged into
+        user programs that drive them with threads: to profile them with perf,
+        run them under sanitizers or fuzz them without loading a module.
+
+    USAGE:
+        Compile the module sources with -I../ucompat, that puts the headers in
+        linux/, asm/, asm-generic/ and trace/ in front of the system ones (all of
+        them include this file), and link ucompat.c. The program talks to the
+        /proc entries the module creates through ucompat_user.h.
+
+    COMMENTARIES
+        Locks are pthread mutexes, rwlocks and condition variables, so are the
+        semaphores and the wait queues. Memory is
+        malloc'ed, user copies are memcpy and the per CPU variables are shared
+        atomics. seq_file, proc_fs, list_sort and rbtree are implemented in
+        ucompat.c following the kernel ones.
+        Not covered: RCU, mmap, signals (the interruptible waits are
+        never interrupted) and the waits for the open files of a removed entry.
+        The headers of the missing parts stop the build with #error.
+=======================================================================================
+*/
+
+#ifndef UCOMPAT_H
+#define UCOMPAT_H
+
+#ifdef __KERNEL__
+ #error "ucompat is only for user space builds"
+#endif
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <linux/types.h>   /* the system one, through ucompat/linux/types.h */
+
+
+/*****************************************************************************
+ * Types and compiler helpers
+ *****************************************************************************/
+
+typedef __u8  u8;
+typedef __u16 u16;
+typedef __u32 u32;
+typedef __u64 u64;
+typedef __s32 s32;
+typedef __s64 s64;
+typedef unsigned int gfp_t;
+typedef unsigned int fmode_t;
+
+#define __user
+#define __rcu
+#define __percpu
+#define __init
+#define __exit
+#define __read_mostly
+
+#define likely(x)       __builtin_expect(!!(x), 1)
+#define unlikely(x)     __builtin_expect(!!(x), 0)
+
+#define READ_ONCE(x)        (*(const volatile __typeof__(x) *)&(x))
+#define WRITE_ONCE(x, v)    (*(volatile __typeof__(x) *)&(x) = (v))
+#define barrier()           __asm__ __volatile__("" ::: "memory")
+#define smp_mb()            __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define smp_rmb()           __atomic_thread_fence(__ATOMIC_ACQUIRE)
+#define smp_wmb()           __atomic_thread_fence(__ATOMIC_RELEASE)
+#define smp_load_acquire(p)     __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define smp_store_release(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+
+#define SMP_CACHE_BYTES     64
+#define ____cacheline_aligned_in_smp __attribute__((__aligned__(SMP_CACHE_BYTES)))
+
+#define container_of(ptr, type, member) ((type *)((char *)(ptr) - offsetof(type, member)))
+#define ARRAY_SIZE(a)       (sizeof(a) / sizeof((a)[0]))
+#define ALIGN(x, a)         (((x) + (a) - 1) & ~((__typeof__(x))(a) - 1))
+#define DIV_ROUND_UP(n, d)  (((n) + (d) - 1) / (d))
+
+#define min(a, b)           ((a) < (b) ? (a) : (b))
+#define max(a, b)           ((a) > (b) ? (a) : (b))
+#define min_t(t, a, b)      ((t)(a) < (t)(b) ? (t)(a) : (t)(b))
+#define max_t(t, a, b)      ((t)(a) > (t)(b) ? (t)(a) : (t)(b))
+#define clamp_t(t, v, lo, hi) min_t(t, max_t(t, v, lo), hi)
+
+#define BUG_ON(c)           do { if (c) abort(); } while (0)
+#define WARN_ON(c)          ({ int __c = !!(c); if (__c) fprintf(stderr, "WARN_ON %s:%d\n", __FILE__, __LINE__); __c; })
+
+#define PAGE_SIZE           4096UL
+#define PAGE_SHIFT          12
+#define PAGE_ALIGN(x)       ALIGN(x, PAGE_SIZE)
+
+static inline int fls64(u64 x) {
+    return x ? 64 - __builtin_clzll(x) : 0;
+}
+
+static inline u64 div64_u64(u64 dividend, u64 divisor) {
+    return dividend / divisor;
+}
+
+/* hash_32 of include/linux/hash.h */
+#define GOLDEN_RATIO_32 0x61C88647
+static inline u32 hash_32(u32 val, unsigned int bits) {
+    return (val * GOLDEN_RATIO_32) >> (32 - bits);
+}
+
+static inline size_t ucompat_strlcpy(char *dest, const char *src, size_t size) {
+    size_t len = strlen(src);
+
+    if (size) {
+        size_t n = len >= size ? size - 1 : len;
+        memcpy(dest, src, n);
+        dest[n] = '\0';
+    }
+    return len;
+}
+#define strlcpy ucompat_strlcpy
+
+
+/*****************************************************************************
+ * Module
+ *****************************************************************************/
+
+#define KERN_INFO           ""
+#define KERN_ALERT          ""
+#define KERN_WARNING        ""
+#define KERN_ERR            ""
+#define printk(...)         fprintf(stderr, __VA_ARGS__)
+#define trace_printk(...)   do { } while (0)
+
+#define THIS_MODULE         NULL
+#define MODULE_LICENSE(x)
+#define MODULE_DESCRIPTION(x)
+#define MODULE_AUTHOR(x)
+#define MODULE_PARM_DESC(name, desc)
+
+/* Every module_param registers its variable before main, ucompat_load() sets
+ * the ones in UCOMPAT_PARAMS ("name=value ...") as insmod would */
+typedef int (*ucompat_param_set_t)(void *var, const char *val);
+void ucompat_param_register(const char *name, void *var, ucompat_param_set_t set);
+int ucompat_param_set_int(void *var, const char *val);
+int ucompat_param_set_uint(void *var, const char *val);
+int ucompat_param_set_ulong(void *var, const char *val);
+int ucompat_param_set_bool(void *var, const char *val);
+int ucompat_param_set_charp(void *var, const char *val);
+
+#define module_param(name, type, perm)                                  \
+    static void __attribute__((constructor)) ucompat_param_##name(void) { \
+        ucompat_param_register(#name, &(name), ucompat_param_set_##type); \
+    }
+#define __module_get(m)     do { } while (0)
+#define module_put(m)       do { } while (0)
+
+/* The program loads and unloads the module with ucompat_load() and ucompat_unload() */
+#define module_init(fn)     int ucompat_module_init(void) { return fn(); }
+#define module_exit(fn)     void ucompat_module_exit(void) { fn(); }
+
+
+/*****************************************************************************
+ * Memory and user copies
+ *****************************************************************************/
+
+#define GFP_KERNEL          0
+#define GFP_ATOMIC          1
+
+#define kmalloc(size, gfp)  malloc(size)
+#define kzalloc(size, gfp)  calloc(1, size)
+#define kfree(p)            free((void *)(p))
+#define vmalloc(size)       malloc(size)
+#define vzalloc(size)       calloc(1, size)
+#define vfree(p)            free((void *)(p))
+#define kvfree(p)           free((void *)(p))
+
+static inline void *vmalloc_user(unsigned long size) {
+    void *p = aligned_alloc(PAGE_SIZE, PAGE_ALIGN(size));
+
+    if (p != NULL)
+        memset(p, 0, PAGE_ALIGN(size));
+    return p;
+}
+
+#define get_zeroed_page(gfp)    ((unsigned long)vmalloc_user(PAGE_SIZE))
+#define free_page(addr)         free((void *)(addr))
+
+#define copy_to_user(to, from, n)   (memcpy(to, from, n), 0UL)
+#define copy_from_user(to, from, n) (memcpy(to, from, n), 0UL)
+
+
+/*****************************************************************************
+ * Locks. Spin locks are mutexes, there are no interrupts to disable
+ *****************************************************************************/
+
+typedef pthread_mutex_t spinlock_t;
+#define DEFINE_SPINLOCK(x)      spinlock_t x = PTHREAD_MUTEX_INITIALIZER
+#define spin_lock_init(l)       pthread_mutex_init(l, NULL)
+#define spin_lock(l)            pthread_mutex_lock(l)
+#define spin_unlock(l)          pthread_mutex_unlock(l)
+#define spin_lock_bh(l)         pthread_mutex_lock(l)
+#define spin_unlock_bh(l)       pthread_mutex_unlock(l)
+
+typedef pthread_rwlock_t rwlock_t;
+#define DEFINE_RWLOCK(x)        rwlock_t x = PTHREAD_RWLOCK_INITIALIZER
+#define rwlock_init(l)          pthread_rwlock_init(l, NULL)
+#define read_lock(l)            pthread_rwlock_rdlock(l)
+#define read_unlock(l)          pthread_rwlock_unlock(l)
+#define write_lock(l)           pthread_rwlock_wrlock(l)
+#define write_unlock(l)         pthread_rwlock_unlock(l)
+
+struct mutex {
+    pthread_mutex_t lock;
+};
+#define DEFINE_MUTEX(x)         struct mutex x = { PTHREAD_MUTEX_INITIALIZER }
+#define mutex_init(m)           pthread_mutex_init(&(m)->lock, NULL)
+#define mutex_lock(m)           pthread_mutex_lock(&(m)->lock)
+#define mutex_unlock(m)         pthread_mutex_unlock(&(m)->lock)
+#define mutex_lock_interruptible(m) (pthread_mutex_lock(&(m)->lock), 0)
+
+struct semaphore {
+    pthread_mutex_t lock;
+    pthread_cond_t wait;
+    int count;
+};
+void sema_init(struct semaphore *sem, int val);
+void down(struct semaphore *sem);
+int down_interruptible(struct semaphore *sem);
+void up(struct semaphore *sem);
+
+/* The condition of a wait is checked with the lock of the queue, wake_up takes it
+ * after the condition changed: no wake up is lost */
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t wait;
+} wait_queue_head_t;
+#define DECLARE_WAIT_QUEUE_HEAD(x) \
+    wait_queue_head_t x = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER }
+#define init_waitqueue_head(q) \
+    do { pthread_mutex_init(&(q)->lock, NULL); pthread_cond_init(&(q)->wait, NULL); } while (0)
+
+/* The barrier is the one of set_current_state: the waker stores the condition
+ * and then checks for waiters, the waiter shows itself and then checks it */
+#define wait_event_interruptible(q, condition) ({           \
+    smp_mb();                                               \
+    pthread_mutex_lock(&(q).lock);                          \
+    while (!(condition))                                    \
+        pthread_cond_wait(&(q).wait, &(q).lock);            \
+    pthread_mutex_unlock(&(q).lock);                        \
+    0;                                                      \
+})
+#define wait_event(q, condition) ((void)wait_event_interruptible(q, condition))
+
+static inline void __wake_up(wait_queue_head_t *q) {
+    pthread_mutex_lock(&q->lock);
+    pthread_cond_broadcast(&q->wait);
+    pthread_mutex_unlock(&q->lock);
+}
+#define wake_up(q)                      __wake_up(q)
+#define wake_up_all(q)                  __wake_up(q)
+#define wake_up_interruptible(q)        __wake_up(q)
+#define wake_up_interruptible_all(q)    __wake_up(q)
+
+
+/*****************************************************************************
+ * Lists (include/linux/list.h and llist.h)
+ *****************************************************************************/
+
+struct list_head {
+    struct list_head *next, *prev;
+};
+
+struct hlist_head {
+    struct hlist_node *first;
+};
+
+struct hlist_node {
+    struct hlist_node *next, **pprev;
+};
+
+#define LIST_HEAD_INIT(name) { &(name), &(name) }
+#define LIST_HEAD(name) struct list_head name = LIST_HEAD_INIT(name)
+
+static inline void INIT_LIST_HEAD(struct list_head *list) {
+    list->next = list;
+    list->prev = list;
+}
+
+static inline void __list_add(struct list_head *new, struct list_head *prev, struct list_head *next) {
+    next->prev = new;
+    new->next = next;
+    new->prev = prev;
+    prev->next = new;
+}
+
+static inline void list_add(struct list_head *new, struct list_head *head) {
+    __list_add(new, head, head->next);
+}
+
+static inline void list_add_tail(struct list_head *new, struct list_head *head) {
+    __list_add(new, head->prev, head);
+}
+
+static inline void __list_del(struct list_head *prev, struct list_head *next) {
+    next->prev = prev;
+    prev->next = next;
+}
+
+static inline void list_del(struct list_head *entry) {
+    __list_del(entry->prev, entry->next);
+    entry->next = NULL;
+    entry->prev = NULL;
+}
+
+static inline void list_del_init(struct list_head *entry) {
+    __list_del(entry->prev, entry->next);
+    INIT_LIST_HEAD(entry);
+}
+
+static inline void list_move_tail(struct list_head *list, struct list_head *head) {
+    __list_del(list->prev, list->next);
+    list_add_tail(list, head);
+}
+
+static inline int list_empty(const struct list_head *head) {
+    return READ_ONCE(head->next) == head;
+}
+
+static inline int list_is_singular(const struct list_head *head) {
+    return !list_empty(head) && (head->next == head->prev);
+}
+
+static inline void __list_cut_position(struct list_head *list, struct list_head *head, struct list_head *entry) {
+    struct list_head *new_first = entry->next;
+
+    list->next = head->next;
+    list->next->prev = list;
+    list->prev = entry;
+    entry->next = list;
+    head->next = new_first;
+    new_first->prev = head;
+}
+
+static inline void list_cut_position(struct list_head *list, struct list_head *head, struct list_head *entry) {
+    if (list_empty(head))
+        return;
+    if (list_is_singular(head) && (head->next != entry && head != entry))
+        return;
+    if (entry == head)
+        INIT_LIST_HEAD(list);
+    else
+        __list_cut_position(list, head, entry);
+}
+
+static inline void __list_splice(const struct list_head *list, struct list_head *prev, struct list_head *next) {
+    struct list_head *first = list->next;
+    struct list_head *last = list->prev;
+
+    first->prev = prev;
+    prev->next = first;
+    last->next = next;
+    next->prev = last;
+}
+
+static inline void list_splice(const struct list_head *list, struct list_head *head) {
+    if (!list_empty(list))
+        __list_splice(list, head, head->next);
+}
+
+static inline void list_splice_tail(struct list_head *list, struct list_head *head) {
+    if (!list_empty(list))
+        __list_splice(list, head->prev, head);
+}
+
+static inline void list_splice_init(struct list_head *list, struct list_head *head) {
+    if (!list_empty(list)) {
+        __list_splice(list, head, head->next);
+        INIT_LIST_HEAD(list);
+    }
+}
+
+static inline void list_splice_tail_init(struct list_head *list, struct list_head *head) {
+    if (!list_empty(list)) {
+        __list_splice(list, head->prev, head);
+        INIT_LIST_HEAD(list);
+    }
+}
+
+#define list_entry(ptr, type, member)       container_of(ptr, type, member)
+#define list_first_entry(ptr, type, member) list_entry((ptr)->next, type, member)
+#define list_last_entry(ptr, type, member)  list_entry((ptr)->prev, type, member)
+#define list_next_entry(pos, member)        list_entry((pos)->member.next, __typeof__(*(pos)), member)
+
+#define list_for_each(pos, head) \
+    for (pos = (head)->next; pos != (head); pos = pos->next)
+
+#define list_for_each_safe(pos, n, head) \
+    for (pos = (head)->next, n = pos->next; pos != (head); pos = n, n = pos->next)
+
+#define list_for_each_entry(pos, head, member) \
+    for (pos = list_first_entry(head, __typeof__(*pos), member); \
+         &pos->member != (head); \
+         pos = list_next_entry(pos, member))
+
+#define list_for_each_entry_safe(pos, n, head, member) \
+    for (pos = list_first_entry(head, __typeof__(*pos), member), \
+         n = list_next_entry(pos, member); \
+         &pos->member != (head); \
+         pos = n, n = list_next_entry(n, member))
+
+#define INIT_HLIST_HEAD(ptr) ((ptr)->first = NULL)
+
+static inline void hlist_add_head(struct hlist_node *n, struct hlist_head *h) {
+    struct hlist_node *first = h->first;
+
+    n->next = first;
+    if (first)
+        first->pprev = &n->next;
+    h->first = n;
+    n->pprev = &h->first;
+}
+
+static inline void hlist_del(struct hlist_node *n) {
+    struct hlist_node *next = n->next;
+    struct hlist_node **pprev = n->pprev;
+
+    *pprev = next;
+    if (next)
+        next->pprev = pprev;
+    n->next = NULL;
+    n->pprev = NULL;
+}
+
+#define hlist_entry(ptr, type, member) container_of(ptr, type, member)
+#define hlist_entry_safe(ptr, type, member) \
+    ({ __typeof__(ptr) ____ptr = (ptr); ____ptr ? hlist_entry(____ptr, type, member) : NULL; })
+
+#define hlist_for_each_entry(pos, head, member) \
+    for (pos = hlist_entry_safe((head)->first, __typeof__(*(pos)), member); \
+         pos; \
+         pos = hlist_entry_safe((pos)->member.next, __typeof__(*(pos)), member))
+
+#define hlist_for_each_entry_safe(pos, n, head, member) \
+    for (pos = hlist_entry_safe((head)->first, __typeof__(*pos), member); \
+         pos && ({ n = pos->member.next; 1; }); \
+         pos = hlist_entry_safe(n, __typeof__(*pos), member))
+
+void list_sort(void *priv, struct list_head *head,
+               int (*cmp)(void *priv, struct list_head *a, struct list_head *b));
+
+struct llist_head {
+    struct llist_node *first;
+};
+
+struct llist_node {
+    struct llist_node *next;
+};
+
+#define LLIST_HEAD(name) struct llist_head name = { NULL }
+#define llist_entry(ptr, type, member) container_of(ptr, type, member)
+#define member_address_is_nonnull(ptr, member) \
+    ((uintptr_t)(ptr) + offsetof(__typeof__(*(ptr)), member) != 0)
+#define llist_for_each_entry_safe(pos, n, node, member) \
+    for (pos = llist_entry((node), __typeof__(*pos), member); \
+         member_address_is_nonnull(pos, member) && \
+            (n = llist_entry(pos->member.next, __typeof__(*n), member), true); \
+         pos = n)
+
+static inline void init_llist_head(struct llist_head *list) {
+    list->first = NULL;
+}
+
+static inline bool llist_empty(const struct llist_head *head) {
+    return READ_ONCE(head->first) == NULL;
+}
+
+/* Returns true if the list was empty */
+static inline bool llist_add(struct llist_node *new, struct llist_head *head) {
+    struct llist_node *first = __atomic_load_n(&head->first, __ATOMIC_RELAXED);
+
+    do {
+        new->next = first;
+    } while (!__atomic_compare_exchange_n(&head->first, &first, new, false,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    return first == NULL;
+}
+
+static inline struct llist_node *llist_del_all(struct llist_head *head) {
+    return __atomic_exchange_n(&head->first, NULL, __ATOMIC_ACQUIRE);
+}
+
+static inline struct llist_node *llist_reverse_order(struct llist_node *head) {
+    struct llist_node *new_head = NULL, *tmp;
+
+    while (head) {
+        tmp = head;
+        head = head->next;
+        tmp->next = new_head;
+        new_head = tmp;
+    }
+    return new_head;
+}
+
+
+/*****************************************************************************
+ * rbtree, with the interface of include/linux/rbtree.h. The color is a field
+ * of its own instead of the low bit of the parent pointer
+ *****************************************************************************/
+
+struct rb_node {
+    struct rb_node *rb_parent;
+    struct rb_node *rb_left;
+    struct rb_node *rb_right;
+    int rb_red;
+};
+
+struct rb_root {
+    struct rb_node *rb_node;
+};
+
+#define RB_ROOT             (struct rb_root) { NULL }
+#define RB_EMPTY_ROOT(root) (READ_ONCE((root)->rb_node) == NULL)
+#define rb_entry(ptr, type, member) container_of(ptr, type, member)
+#define rb_entry_safe(ptr, type, member) \
+    ({ __typeof__(ptr) ____ptr = (ptr); ____ptr ? rb_entry(____ptr, type, member) : NULL; })
+
+static inline void rb_link_node(struct rb_node *node, struct rb_node *parent, struct rb_node **rb_link) {
+    node->rb_parent = parent;
+    node->rb_left = node->rb_right = NULL;
+    node->rb_red = 1;
+    *rb_link = node;
+}
+
+void rb_insert_color(struct rb_node *node, struct rb_root *root);
+void rb_erase(struct rb_node *node, struct rb_root *root);
+struct rb_node *rb_first(const struct rb_root *root);
+struct rb_node *rb_last(const struct rb_root *root);
+struct rb_node *rb_next(const struct rb_node *node);
+struct rb_node *rb_prev(const struct rb_node *node);
+struct rb_node *rb_first_postorder(const struct rb_root *root);
+struct rb_node *rb_next_postorder(const struct rb_node *node);
+
+#define rbtree_postorder_for_each_entry_safe(pos, n, root, field) \
+    for (pos = rb_entry_safe(rb_first_postorder(root), __typeof__(*pos), field); \
+         pos && ({ n = rb_entry_safe(rb_next_postorder(&pos->field), __typeof__(*pos), field); 1; }); \
+         pos = n)
+
+
+/*****************************************************************************
+ * sort and bsearch (the ones of libc, without the swap function)
+ *****************************************************************************/
+
+#define sort(base, num, size, cmp, swap) qsort(base, num, size, cmp)
+
+
+/*****************************************************************************
+ * Per CPU data, shared by every thread and changed with atomics
+ *****************************************************************************/
+
+#define DEFINE_PER_CPU(type, name)      type name
+#define per_cpu_ptr(ptr, cpu)           (ptr)
+#define for_each_possible_cpu(cpu)      for ((cpu) = 0; (cpu) < 1; (cpu)++)
+#define this_cpu_inc(var)               __atomic_fetch_add(&(var), 1, __ATOMIC_RELAXED)
+#define this_cpu_add(var, n)            __atomic_fetch_add(&(var), n, __ATOMIC_RELAXED)
+
+
+/*****************************************************************************
+ * Time and scheduling
+ *****************************************************************************/
+
+#include <time.h>
+
+static inline u64 ktime_get_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+#include <sched.h>
+
+#define cond_resched()      sched_yield()
+
+
+/*****************************************************************************
+ * Files, /proc entries and seq_file
+ *****************************************************************************/
+
+#define FMODE_READ      0x1
+#define FMODE_WRITE     0x2
+
+struct inode {
+    void *i_private;            // data of the /proc entry
+};
+
+struct file {
+    fmode_t f_mode;
+    unsigned int f_flags;
+    loff_t f_pos;
+    void *private_data;
+    struct inode *f_inode;
+};
+
+#define file_inode(f)   ((f)->f_inode)
+#define PDE_DATA(inode) ((inode)->i_private)
+
+struct page;
+struct vm_operations_struct;
+
+struct vm_area_struct {
+    unsigned long vm_start, vm_end, vm_pgoff, vm_flags;
+    void *vm_private_data;
+    const struct vm_operations_struct *vm_ops;
+};
+
+struct vm_operations_struct {
+    void (*open)(struct vm_area_struct *vma);
+    void (*close)(struct vm_area_struct *vma);
+};
+
+#define VM_WRITE        0x00000002
+#define VM_MAYWRITE     0x00000020
+
+/* There is no mmap in user space, the file operations that need it fail */
+#define virt_to_page(addr)              ((struct page *)(addr))
+#define vmalloc_to_page(addr)           ((struct page *)(addr))
+static inline int vm_insert_page(struct vm_area_struct *vma, unsigned long addr, struct page *page) {
+    return -ENODEV;
+}
+
+struct file_operations {
+    void *owner;
+    int (*open)(struct inode *, struct file *);
+    int (*release)(struct inode *, struct file *);
+    ssize_t (*read)(struct file *, char __user *, size_t, loff_t *);
+    ssize_t (*write)(struct file *, const char __user *, size_t, loff_t *);
+    loff_t (*llseek)(struct file *, loff_t, int);
+    long (*unlocked_ioctl)(struct file *, unsigned int, unsigned long);
+    long (*compat_ioctl)(struct file *, unsigned int, unsigned long);
+    int (*mmap)(struct file *, struct vm_area_struct *);
+};
+
+struct proc_dir_entry;
+
+struct proc_dir_entry *proc_create_data(const char *name, int mode, struct proc_dir_entry *parent,
+                                        const struct file_operations *fops, void *data);
+struct proc_dir_entry *proc_mkdir(const char *name, struct proc_dir_entry *parent);
+void remove_proc_entry(const char *name, struct proc_dir_entry *parent);
+#define proc_create(name, mode, parent, fops) proc_create_data(name, mode, parent, fops, NULL)
+
+struct seq_operations;
+
+struct seq_file {
+    char *buf;
+    size_t size;
+    size_t from;
+    size_t count;
+    loff_t index;
+    loff_t read_pos;
+    pthread_mutex_t lock;
+    const struct seq_operations *op;
+    void *private;
+};
+
+struct seq_operations {
+    void *(*start)(struct seq_file *m, loff_t *pos);
+    void (*stop)(struct seq_file *m, void *v);
+    void *(*next)(struct seq_file *m, void *v, loff_t *pos);
+    int (*show)(struct seq_file *m, void *v);
+};
+
+ssize_t seq_read(struct file *file, char __user *buf, size_t size, loff_t *ppos);
+loff_t seq_lseek(struct file *file, loff_t offset, int whence);
+int seq_open(struct file *file, const struct seq_operations *op);
+int seq_release(struct inode *inode, struct file *file);
+void *__seq_open_private(struct file *file, const struct seq_operations *op, int psize);
+int seq_release_private(struct inode *inode, struct file *file);
+int single_open(struct file *file, int (*show)(struct seq_file *, void *), void *data);
+int single_release(struct inode *inode, struct file *file);
+
+void seq_printf(struct seq_file *m, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+void seq_putc(struct seq_file *m, char c);
+void seq_puts(struct seq_file *m, const char *s);
+void seq_write(struct seq_file *m, const void *data, size_t len);
+
+static inline bool seq_has_overflowed(struct seq_file *m) {
+    return m->count == m->size;
+}
+
+
+/*****************************************************************************
+ * Tracepoints, every event is an empty function
+ *****************************************************************************/
+
+#define TP_PROTO(args...)   args
+#define TP_ARGS(args...)    args
+#define TRACE_EVENT(name, proto, args, tstruct, assign, print) \
+    static inline void trace_##name(proto) { }
+#define DECLARE_EVENT_CLASS(name, proto, args, tstruct, assign, print)
+#define DEFINE_EVENT(template, name, proto, args) \
+    static inline void trace_##name(proto) { }
+
+#endif
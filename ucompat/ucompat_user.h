@@ -0,0 +1,30 @@
+#ifndef UCOMPAT_USER_H
+#define UCOMPAT_USER_H
+
+/*
+ * Side of ucompat seen by the user program linked with a module. The calls
+ * behave like the system calls of the same name on the /proc entries the
+ * module created: they return -1 and set errno on error.
+ *
+ * Every call on a file is serialized with the others of the same file, as
+ * the kernel does with the position of a file. The threads that have to
+ * block at the same time (a fifo reader and its writer) need their own files.
+ */
+
+#include <sys/types.h>
+
+/* Sets the module parameters in the environment variable UCOMPAT_PARAMS,
+ * "name=value" separated by spaces, then runs the module_init function */
+int ucompat_load(void);
+
+/* Runs the module_exit function. Every file must be closed */
+void ucompat_unload(void);
+
+/* path is the one of the entry, with or without "/proc/" */
+int ucompat_open(const char *path, int flags);
+ssize_t ucompat_read(int fd, void *buf, size_t count);
+ssize_t ucompat_write(int fd, const void *buf, size_t count);
+long ucompat_ioctl(int fd, unsigned int cmd, unsigned long arg);
+int ucompat_close(int fd);
+
+#endif